@@ -9,7 +9,7 @@ public:
       /// Called once after daemon starts automatically with system startup or when you manually call `$ systemctl start my_daemon`
       /// Initialize your code here...
 
-      dlog::info("my_daemon::on_start(): my_daemon version: " + cfg.get("version") + " started successfully!");
+      dlog::info("my_daemon::on_start(): my_daemon version: {} started successfully!", cfg.get("version"));
     }
 
     void on_update() override {
@@ -30,7 +30,7 @@ public:
       /// Called once after your daemon's config fil is updated then reloaded with `$ systemctl reload my_daemon`
       /// Handle your config updates here...
 
-      dlog::info("my_daemon::on_reload(): new daemon version from updated config: " + cfg.get("version"));
+      dlog::info("my_daemon::on_reload(): new daemon version from updated config: {}", cfg.get("version"));
     }
 };
 
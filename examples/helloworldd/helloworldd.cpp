@@ -8,7 +8,7 @@ public:
       /// Runs once after daemon starts:
       /// Initialize your code here...
 
-      dlog::info("on_start: helloworldd version " + cfg.get("version") + " started!");
+      dlog::info("on_start: helloworldd version {} started!", cfg.get("version"));
     }
 
     void on_update() override {
@@ -29,7 +29,7 @@ public:
       /// Runs once after your daemon is reloaded
       /// Runs once after your daemon's config or service files are updated then reloaded with `$ systemctl reload my_daemon`
 
-      dlog::info("on_reload: helloworldd reloaded: " + cfg.get("version"));
+      dlog::info("on_reload: helloworldd reloaded: {}", cfg.get("version"));
     }
 };
 
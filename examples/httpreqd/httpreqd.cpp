@@ -34,14 +34,14 @@ public:
       /// Called every DURATION set in set_update_duration()...
       /// Update your code here...
 
-      try {
-
+      // Offload the blocking request to the daemon's worker pool so a slow endpoint does not delay the next tick,
+      // the continuation runs back on the daemon's thread.
+      get_pool().submit([this]() {
         nl::json response = http_get(BORED_API_ENDPOINT);
-        dlog::info(response["activity"]);
-
-      } catch(const std::exception& e) {
-        dlog::error(e.what());
-      }
+        return response["activity"].get<std::string>();
+      }, [](const std::string& activity) {
+        dlog::info(activity);
+      });
 
     }
 
@@ -1,4 +1,6 @@
 #include "daemon.hpp"
+#include <iomanip>
+#include <sstream>
 using namespace daemonpp;
 using namespace std::chrono_literals;
 
@@ -8,12 +10,16 @@ public:
     void on_start(const dconfig& cfg) override {
       /// Called once after daemon starts:
       /// Initialize your code here...
-      dlog::info("on_start: temperatured started: version=" + cfg.get("version"));
+      dlog::info("on_start: temperatured started: version={}", cfg.get("version"));
 
       // Note that our current working directory is pointed at /tmp (see main function)
-      // this file will be created at /tmp/temperatured.txt
-      temperature_history_file.open("temperatured.txt", std::ios::app);
-      temperature_history_file << std::fixed << std::setprecision(2);
+      // this file will be created at /tmp/temperatured.txt, rotated daily to /tmp/temperatured.txt.<date>.gz
+      dlogfile::options history;
+      history.segment_size = 1024 * 1024;
+      history.max_age = std::chrono::hours(24);
+      history.keep = 30;
+      if(!temperature_history.open("temperatured.txt", history))
+        dlog::error("on_start: could not open temperatured.txt");
     }
 
     void on_update() override {
@@ -21,35 +27,39 @@ public:
       /// Update your code here...
 
       const double temp = get_cpu_temperature();
-      temperature_history_file << '[' << get_current_date_time() << "] " << temp << "°C ";
+      std::ostringstream line;
+      line << std::fixed << std::setprecision(2);
+      line << '[' << get_current_date_time() << "] " << temp << "°C ";
       if (temp < -10.0) {
-        temperature_history_file << "(Frozen)";
+        line << "(Frozen)";
       } else if (temp > 100.0) {
-        temperature_history_file << "(Burning)";
+        line << "(Burning)";
       } else {
         for (const auto &[range, status]: statuses) {
           const auto &[min_c, max_c] = range;
           if (is_between(temp, min_c, max_c)) {
-            temperature_history_file << '(' << status << ')' << std::endl;
+            line << '(' << status << ')';
             break;
           }
         }
       }
-      temperature_history_file << std::endl;
+      line << '\n';
+      // A memcpy into the mapped file, no flush to the disk per line.
+      temperature_history.write(line.str());
+      temperature_history.flush();
     }
 
     void on_stop() override {
       /// Called once before daemon is about to exit.
       /// Cleanup your code here...
-      if(temperature_history_file.is_open())
-        temperature_history_file.close();
+      temperature_history.close();
       dlog::info("on_stop: temperatured stopped.");
     }
 
     void on_reload(const dconfig& cfg) override {
       /// Called once after your daemon's config or service files are updated
       /// then reloaded with `$ systemctl reload my_daemon`
-      dlog::info("on_reload: temperatured reloaded: version=" + cfg.get("version"));
+      dlog::info("on_reload: temperatured reloaded: version={}", cfg.get("version"));
     }
 
 private:
@@ -95,7 +105,7 @@ private:
     }
 
 private:
-    std::ofstream temperature_history_file;
+    dlogfile temperature_history;
     const std::map<std::pair<double, double>, std::string> statuses = {
       {{-10.0, 10.0}, "Cold"},
       {{10.1, 25.0}, "Cool"},
@@ -112,6 +122,7 @@ int main(int argc, const char* argv[]) {
   temperatured dmn;
   dmn.set_name("temperatured");
   dmn.set_update_duration(1s);
+  dmn.set_tick_policy(tick_policy::fixed_rate_skip); // sample on a drift free 1s grid
   dmn.set_cwd("/tmp");
   dmn.run(argc, argv);
   return 0;
@@ -9,15 +9,86 @@
 #include <string>
 #include <csignal>
 #include <sys/stat.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <netdb.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdexcept>
 #include <chrono>
+#include <ctime>
 #include <thread>
 #include <atomic>
-#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <fstream>
+#include <vector>
+#include <utility>
 #include "dlog.hpp"
+#include "dloop.hpp"
+#include "dscheduler.hpp"
+#include "dpool.hpp"
+#include "dnotify.hpp"
+#include "dupgrade.hpp"
+#include "dsched.hpp"
+#include "dmemory.hpp"
+#include "dcgroup.hpp"
+#include "dmetrics.hpp"
+#include "dhttp.hpp"
+#include "dstats.hpp"
+#include "dcontrol.hpp"
+#include "dwatchdog.hpp"
+#include "dprofiler.hpp"
 #include "dconfig.hpp"
 
 namespace daemonpp {
+  /**
+   * How the update loop schedules on_update() calls.
+   */
+  enum class tick_policy {
+    fixed_delay,          ///< sleep update_duration after on_update() returns (period = update_duration + on_update() runtime), default
+    fixed_rate_skip,      ///< wake at absolute deadlines, drop missed ticks and wait for the next deadline on the grid
+    fixed_rate_burst,     ///< wake at absolute deadlines, run missed ticks back to back until caught up
+    fixed_rate_coalesce   ///< wake at absolute deadlines, run missed ticks as a single on_update() then continue on the grid
+  };
+
+  /**
+   * How run() starts the daemon process.
+   */
+  enum class start_mode {
+    automatic, ///< notify when started by systemd with Type=notify ($NOTIFY_SOCKET is set), forking otherwise, default
+    forking,   ///< fork and let the parent exit (.service Type=forking)
+    notify     ///< stay in the foreground and report readiness/watchdog over $NOTIFY_SOCKET (.service Type=notify)
+  };
+
+  /**
+   * CPU placement of the worker processes (see daemon::set_workers()).
+   */
+  enum class worker_affinity {
+    none,     ///< let the kernel schedule the workers
+    cpu,      ///< pin worker i to the i-th allowed CPU (round robin), default
+    numa_node ///< pin worker i to the allowed CPUs of NUMA node i (round robin)
+  };
+
+  /**
+   * Tick scheduling counters, see daemon::get_tick_stats().
+   */
+  struct tick_stats {
+    std::uint64_t ticks{0};    ///< number of on_update() calls
+    std::uint64_t overruns{0}; ///< ticks whose on_update() ran past the next deadline
+    std::uint64_t missed{0};   ///< deadlines dropped (fixed_rate_skip) or merged (fixed_rate_coalesce)
+    std::chrono::nanoseconds last_lateness{0};  ///< how late the last tick started compared to its deadline
+    std::chrono::nanoseconds max_lateness{0};   ///< worst lateness seen so far
+    std::chrono::nanoseconds total_lateness{0}; ///< sum of all ticks lateness, divide by ticks for the average
+  };
+
   class daemon {
     private:
         static daemon* instance;
@@ -37,6 +108,7 @@ namespace daemonpp {
             std::exit(EXIT_FAILURE);
           }
           instance = this;
+          set_default_signal_handlers();
         }
 
         daemon() : m_name("<unknown_daemon>"), m_cwd("/"), m_update_duration(std::chrono::seconds(10)), m_is_running(false)
@@ -46,6 +118,7 @@ namespace daemonpp {
             std::exit(EXIT_FAILURE);
           }
           instance = this;
+          set_default_signal_handlers();
         }
 
         void run(const int argc, const char* argv[])
@@ -69,33 +142,123 @@ namespace daemonpp {
             }
           }
 
+          // Remember how we were started, a hot upgrade execs the binary installed at the same path with the same arguments.
+          m_argv.assign(argv, argv + argc);
+          char exe[PATH_MAX];
+          const ssize_t exe_length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+          if(exe_length > 0) m_exe.assign(exe, static_cast<std::size_t>(exe_length));
+
+          // Take the listening sockets handed over by systemd socket activation, before forking changes our pid.
+          m_listen_fds = dnotify::listen_fds();
+          // Or by the previous process when started by a hot upgrade, with its state.
+          std::string upgrade_state;
+          if(const char* upgrade_fd = std::getenv(dupgrade::ENV_FD)) {
+            m_upgrade_fd = std::atoi(upgrade_fd);
+            unsetenv(dupgrade::ENV_FD);
+            std::vector<std::pair<std::string, int>> fds;
+            if(dupgrade::receive(m_upgrade_fd, fds, upgrade_state)) {
+              m_upgraded = true;
+              m_listen_fds.insert(m_listen_fds.end(), fds.begin(), fds.end());
+            } else {
+              // Start cold, the old process keeps running until our handover socket closes.
+              ::close(m_upgrade_fd);
+              m_upgrade_fd = -1;
+            }
+          }
+
           // Daemonize this program by forking parent process.
           daemonize();
+          // In prefork mode the master supervises the workers until stopped, the workers carry on below.
+          if(m_worker_count > 0 && run_master())
+            return;
+          for(const std::pair<std::string, int>& listen_fd : m_listen_fds)
+            dlog::info("Inherited listening socket '" + listen_fd.first + "' (fd " + std::to_string(listen_fd.second) + ").");
+          // io_uring rings must be created by the process using them, so after the fork.
+          if(m_loop_backend == dloop::backend::io_uring)
+            m_loop.use_io_uring();
+          // Memory locks are not inherited by fork(), so only now. Prefaulted pages are locked as well.
+          if(m_lock_memory) dmemory::lock_all(m_lock_memory_on_fault);
+          if(m_prefault_stack > 0) dmemory::prefault_stack(m_prefault_stack);
+          if(m_prefault_heap > 0) dmemory::prefault_heap(m_prefault_heap);
 
           // Mark as running (better to have it before on_start() as user may call stop() inside on_start()).
           m_is_running = true;
-          on_start(dconfig::from_file(m_config_file));
+          m_tick_timer = m_loop.add_timer(std::chrono::nanoseconds::zero(), [this]() { m_tick_due = true; });
+          const dconfig cfg = dconfig::from_file(m_config_file);
+          apply_log_settings(cfg);
+          apply_pressure_settings(cfg);
+          apply_metrics_settings(cfg);
+          apply_stats_settings(cfg);
+          apply_control_settings(cfg);
+          apply_watchdog_settings(cfg);
+          apply_profile_settings(cfg);
+          if(m_upgraded) on_upgrade_restore(upgrade_state);
+          on_start(cfg);
+          if(m_upgraded) {
+            // The old process tells systemd we are its new main process, then drains and exits.
+            const char ready = dupgrade::READY;
+            if(::write(m_upgrade_fd, &ready, 1) != 1)
+              dlog::error("Could not report readiness to the old process: " + std::string(std::strerror(errno)));
+            ::close(m_upgrade_fd);
+            m_upgrade_fd = -1;
+          } else {
+            // Only now is the daemon really up: tell systemd so dependent units start after on_start() finished.
+            dnotify::ready();
+            set_status("Running");
+          }
+          const std::chrono::microseconds watchdog_interval = dnotify::watchdog_interval();
+          if(watchdog_interval > std::chrono::microseconds::zero()) {
+            // Pinged from the daemon's loop, so a stuck on_update() stops the pings and systemd restarts us.
+            add_task("daemonpp.watchdog", watchdog_interval / 2, []() { dnotify::watchdog(); });
+          }
+          // Deadlines are absolute points on the monotonic clock, so in fixed rate mode
+          // on_update() runtime and wake up latency do not accumulate into drift.
+          m_next_tick = std::chrono::steady_clock::now();
+          publish_health_deadline();
           while(m_is_running.load())
           {
+            const auto tick_begin = std::chrono::steady_clock::now();
+            record_lateness(tick_begin - m_next_tick);
+            m_watchdog.begin(tick_begin);
+            if(m_log_journal) dlog::set_field("TICK_ID", std::to_string(m_tick_stats.ticks + 1));
             on_update();
-            // On long sleeps, if we want to exit we need a cv to wake up the thread from sleep to carry on exiting.
-            std::unique_lock<std::mutex> lock(m_mutex);
-            m_update_cv.wait_for(lock, m_update_duration, [this]() {
-              return !m_is_running.load();
-            });
+            m_watchdog.end();
+            const auto update_time = std::chrono::steady_clock::now() - tick_begin;
+            m_update_duration_metric.record(update_time);
+            m_tick_stats.ticks++;
+            m_next_tick = next_deadline(m_next_tick);
+            publish_health_deadline();
+            if(m_stats.is_open()) publish_tick(update_time);
+            // Serve fds, timers and posted tasks until the next tick is due.
+            // On long sleeps, if we want to exit stop() wakes the loop up to carry on exiting.
+            m_tick_due = false;
+            m_loop.set_timer_at(m_tick_timer, m_next_tick);
+            while(m_is_running.load() && !m_tick_due)
+              m_loop.run_once(-1);
           }
+          m_loop.cancel_timer(m_tick_timer);
+          if(m_upgrade_pid <= 0) dnotify::stopping(); // after an upgrade, systemd tracks the new process already
           on_stop();
+          if(m_profiler.is_running()) stop_profile();
+          // Close the metrics endpoint, the control socket (removing their unix sockets) and the stats segment.
+          stop_http();
+          m_control.close();
+          m_stats.close();
+          m_watchdog.stop();
+          // Finish the offloaded work and join the workers.
+          m_pool.reset();
         }
 
         void stop(std::int32_t code = EXIT_SUCCESS)
         {
           m_exit_code = code;
           m_is_running.store(false);
-          m_update_cv.notify_all();
+          m_loop.wakeup();
         }
 
         ~daemon() {
           dlog::shutdown();
+          dnotify::shutdown();
           // Terminate the child process when the daemon completes (loop stopped)
           // note that calling std::exit() inside the run function will not call dtor.
           std::exit(m_exit_code);
@@ -136,26 +299,548 @@ namespace daemonpp {
          */
         virtual void on_reload(const dconfig& cfg) = 0;
 
+        /**
+         * @brief Called on the running daemon when a hot upgrade starts (see upgrade()), optional.
+         * @return state to hand over to the new process (sessions, caches, counters...), serialized as you like
+         */
+        virtual std::string on_upgrade_save() { return std::string(); }
+
+        /**
+         * @brief Called on the new process of a hot upgrade, right before on_start(), optional.
+         * @param state: the blob returned by on_upgrade_save() of the old process
+         */
+        virtual void on_upgrade_restore(const std::string& state) { (void) state; }
+
+    public: // signals
+        /// Called on the daemon's thread (never in signal context) with the received signal number.
+        using signal_callback = std::function<void(std::int32_t sig)>;
+
+        /**
+         * Register (or replace) the handler of a signal.
+         * Signals are blocked and delivered through a signalfd read by the daemon's event loop, so handlers
+         * run on the daemon's thread between ticks and may safely allocate, log, lock or reload config.
+         * Defaults: SIGTERM and SIGINT call stop(), SIGHUP calls on_reload() with the re-read config file,
+         * SIGUSR2 starts a CPU profile (see start_profile()) or ends the running one.
+         * @note: register your handlers before run() (or in on_start() before starting threads),
+         * so that every thread inherits the blocked signal mask.
+         * @param sig: signal number, e.g SIGUSR1, SIGUSR2
+         * @param callback: handler, nullptr to ignore the signal
+         */
+        void set_signal_handler(std::int32_t sig, signal_callback callback) {
+          if(!callback) callback = [](std::int32_t) {};
+          m_signal_handlers[sig] = std::move(callback);
+          if(m_signal_fd >= 0) watch_signals();
+        }
+
     private:
-        static void signal_handler(std::int32_t sig) {
-          dlog::info("Signal " + std::to_string(sig) + " received.");
-          switch (sig) {
-            // daemon.service handler: ExecStop=/bin/kill -s SIGTERM $MAINPID
-            // When daemon is stopped, system sends SIGTERM first, if daemon didn't respond during 90 seconds, it will send a SIGKILL signal
-            case SIGTERM:
-            case SIGKILL: {
-              instance->stop();
-              break;
+        void set_default_signal_handlers() {
+          // daemon.service handler: ExecStop=/bin/kill -s SIGTERM $MAINPID
+          // When daemon is stopped, system sends SIGTERM first, if daemon didn't respond during 90 seconds, it will send a SIGKILL signal
+          m_signal_handlers[SIGTERM] = [this](std::int32_t) { stop(); };
+          m_signal_handlers[SIGINT] = [this](std::int32_t) { stop(); };
+          // daemon.service handler: ExecReload=/bin/kill -s SIGHUP $MAINPID
+          // When daemon is reloaded due updates in .service or .conf, system sends SIGHUB signal.
+          m_signal_handlers[SIGHUP] = [this](std::int32_t) { reload(); };
+          // kill -s SIGUSR2 $MAINPID profiles for profile_seconds, a second SIGUSR2 ends it early.
+          m_signal_handlers[SIGUSR2] = [this](std::int32_t) {
+            if(m_profiler.is_running()) stop_profile();
+            else start_profile(m_profile_duration);
+          };
+        }
+
+        /**
+         * Block the registered signals and (re)create the signalfd watching them.
+         */
+        void watch_signals() {
+          sigset_t mask;
+          sigemptyset(&mask);
+          for(const auto& handler : m_signal_handlers)
+            sigaddset(&mask, handler.first);
+          if(pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+            dlog::error("Could not block signals: " + std::string(std::strerror(errno)));
+            return;
+          }
+          const int fd = signalfd(m_signal_fd, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+          if(fd < 0) {
+            dlog::error("Could not create signalfd: " + std::string(std::strerror(errno)));
+            return;
+          }
+          if(m_signal_fd < 0) {
+            m_signal_fd = fd;
+            m_loop.add_fd(m_signal_fd, EPOLLIN, [this](std::uint32_t) { dispatch_signals(); });
+          }
+        }
+
+        void dispatch_signals() {
+          signalfd_siginfo infos[16];
+          ssize_t n;
+          while((n = ::read(m_signal_fd, infos, sizeof(infos))) > 0) {
+            for(std::size_t i = 0; i < static_cast<std::size_t>(n) / sizeof(signalfd_siginfo); i++) {
+              const std::int32_t sig = static_cast<std::int32_t>(infos[i].ssi_signo);
+              dlog::info("Signal {} received.", sig);
+              dmetrics::get_counter("daemonpp_signals_total{signal=\"" + std::to_string(sig) + "\"}", "Signals received").inc();
+              auto it = m_signal_handlers.find(sig);
+              if(it != m_signal_handlers.end())
+                it->second(sig);
             }
-            // daemon.service handler: ExecReload=/bin/kill -s SIGHUP $MAINPID
-            // When daemon is reloaded due updates in .service or .conf, system sends SIGHUB signal.
-            case SIGHUP: {
-              instance->on_reload(dconfig::from_file(instance->m_config_file));
-              break;
+          }
+        }
+
+        void reload() {
+          dnotify::reloading();
+          m_reloads_metric.inc();
+          const dconfig cfg = dconfig::from_file(m_config_file);
+          apply_scheduling(cfg);
+          apply_log_settings(cfg);
+          apply_pressure_settings(cfg);
+          apply_metrics_settings(cfg);
+          apply_stats_settings(cfg);
+          apply_control_settings(cfg);
+          apply_watchdog_settings(cfg);
+          apply_profile_settings(cfg);
+          on_reload(cfg);
+          dnotify::ready();
+        }
+
+        /**
+         * Apply the loop_* scheduling settings of the config (see dsched) to the daemon's thread and the worker_* ones
+         * to the pool threads. A setting removed from the config goes back to the process' original one.
+         */
+        void apply_scheduling(const dconfig& cfg) {
+          if(!m_sched_defaults_saved) {
+            m_sched_defaults = dsched::current();
+            m_sched_defaults_saved = true;
+            // Helper threads would inherit the loop's settings (e.g a real time policy and a CPU pin): back to the process'.
+            dlog::set_writer_setup([this]() { dsched::apply(m_sched_defaults); });
+            m_watchdog.set_thread_setup([this]() { dsched::apply(m_sched_defaults); });
+          }
+          dsched::settings loop = dsched::from_config(cfg, "loop_");
+          if(m_worker_pinned) loop.has_affinity = false; // the worker's pin wins, as at startup
+          dsched::apply(m_sched_defaults.overlay(loop));
+          m_worker_sched = m_sched_defaults.overlay(dsched::from_config(cfg, "worker_"));
+          if(m_pool) set_pool_scheduling();
+        }
+
+        /**
+         * Log asynchronously (see dlog::start_async()) with:
+         *   log_async=true
+         *   log_queue_size=4096       # queued messages
+         *   log_overflow=drop         # or block, when the queue is full
+         *   log_binary_file=/var/log/my_daemon/my_daemon.dlog   # unformatted, instead of syslog, see dlog::start_binary()
+         *   log_journal=true          # journald's native protocol with structured fields, see dlog::start_journal()
+         *   log_journal_socket=/run/systemd/journal/socket
+         *   log_file=/var/log/my_daemon/my_daemon.log           # rotating mmap'd file instead of syslog, see dlog::start_file()
+         *   log_file_segment_mb=64    # rotate at that size
+         *   log_file_max_age_seconds=86400                      # and at that age, size only by default
+         *   log_file_sync_kb=0        # msync() every that many KiB, 0 leaves it to the kernel
+         *   log_file_keep=10          # rotated segments kept
+         *   log_file_compress=true    # gzip the rotated segments (with zlib)
+         *   log_level=info            # lowest priority logged, debug (all) by default, see dlog::set_level()
+         * In prefork mode each worker writes its own binary log or log file, at path.<worker id>.
+         * Journal records of on_update() carry the tick's number in TICK_ID.
+         */
+        void apply_log_settings(const dconfig& cfg) {
+          auto enabled = [&cfg](const std::string& key) {
+            const std::string value = cfg.get(key);
+            return value == "true" || value == "yes" || value == "1";
+          };
+          const std::string level = cfg.get("log_level");
+          const std::int32_t priority = level.empty() ? LOG_DEBUG : dlog::priority_of(level);
+          if(priority < 0) dlog::error("Unknown log_level '" + level + "'.");
+          else dlog::set_level(priority);
+          std::string binary = cfg.get("log_binary_file");
+          std::string file = cfg.get("log_file");
+          m_log_journal = false;
+          if(!enabled("log_async") && !enabled("log_journal") && binary.empty() && file.empty()) {
+            dlog::stop_async();
+            return;
+          }
+          const std::string size = cfg.get("log_queue_size");
+          const long value = size.empty() ? 4096 : std::atol(size.c_str());
+          const std::size_t capacity = static_cast<std::size_t>(value > 0 ? value : 4096);
+          const dlog::overflow policy = cfg.get("log_overflow") == "block" ? dlog::overflow::block : dlog::overflow::drop;
+          if(!binary.empty()) {
+            if(m_worker_id >= 0) binary += "." + std::to_string(m_worker_id);
+            if(dlog::start_binary(binary, capacity, policy)) return;
+          } else if(!file.empty()) {
+            auto number = [&cfg](const std::string& key, long fallback) {
+              const std::string value = cfg.get(key);
+              const long n = value.empty() ? fallback : std::atol(value.c_str());
+              return static_cast<std::size_t>(n > 0 ? n : 0);
+            };
+            dlogfile::options options;
+            options.segment_size = std::max<std::size_t>(number("log_file_segment_mb", 64), 1) * 1024 * 1024;
+            options.max_age = std::chrono::seconds(number("log_file_max_age_seconds", 0));
+            options.sync_bytes = number("log_file_sync_kb", 0) * 1024;
+            options.keep = number("log_file_keep", 10);
+            options.compress = cfg.get("log_file_compress").empty() || enabled("log_file_compress");
+            if(m_worker_id >= 0) file += "." + std::to_string(m_worker_id);
+            if(dlog::start_file(file, options, capacity, policy)) return;
+          } else if(enabled("log_journal")) {
+            const std::string socket = cfg.get("log_journal_socket");
+            m_log_journal = dlog::start_journal(socket.empty() ? "/run/systemd/journal/socket" : socket, capacity, policy);
+            if(m_log_journal) return;
+          }
+          dlog::start_async(capacity, policy);
+        }
+
+        /**
+         * Read the pressure thresholds of the config and watch the cgroup's pressure when one is set:
+         *   pressure_cpu_threshold=40       # cpu.pressure "some avg10" in %
+         *   pressure_memory_threshold=10    # memory.pressure "some avg10" in %
+         *   memory_usage_threshold=90       # memory.current in % of memory.max
+         *   pressure_max_stretch=4          # maximum on_update() period multiplier
+         */
+        void apply_pressure_settings(const dconfig& cfg) {
+          auto number = [&cfg](const std::string& key, double fallback) {
+            const std::string value = cfg.get(key);
+            return value.empty() ? fallback : std::atof(value.c_str());
+          };
+          m_cpu_pressure_threshold = number("pressure_cpu_threshold", 0.0);
+          m_memory_pressure_threshold = number("pressure_memory_threshold", 0.0);
+          m_memory_usage_threshold = number("memory_usage_threshold", 0.0);
+          m_max_tick_stretch = static_cast<std::uint32_t>(std::max(1.0, number("pressure_max_stretch", 4.0)));
+          if(m_cpu_pressure_threshold > 0.0 || m_memory_pressure_threshold > 0.0 || m_memory_usage_threshold > 0.0) {
+            // PSI averages are updated every 2 seconds
+            add_task("daemonpp.pressure", std::chrono::seconds(2), [this]() { check_pressure(); });
+          } else {
+            cancel_task("daemonpp.pressure");
+            m_tick_stretch = 1;
+            m_shedding = false;
+          }
+        }
+
+        /**
+         * Back off while the host or the container is contended: double the on_update() period and shed optional
+         * work (is_shedding()) when a threshold is crossed, recover step by step once every value is back under
+         * half its threshold.
+         */
+        void check_pressure() {
+          bool hot = false, calm = true;
+          auto check = [&hot, &calm](double value, double threshold) {
+            if(threshold <= 0.0) return;
+            if(value >= threshold) hot = true;
+            if(value >= threshold / 2.0) calm = false;
+          };
+          dcgroup::pressure p;
+          if(m_cpu_pressure_threshold > 0.0 && dcgroup::read_pressure("cpu", p))
+            check(p.some_avg10, m_cpu_pressure_threshold);
+          if(m_memory_pressure_threshold > 0.0 && dcgroup::read_pressure("memory", p))
+            check(p.some_avg10, m_memory_pressure_threshold);
+          if(m_memory_usage_threshold > 0.0) {
+            const std::uint64_t limit = dcgroup::memory_limit();
+            if(limit > 0)
+              check(100.0 * static_cast<double>(dcgroup::memory_usage()) / static_cast<double>(limit), m_memory_usage_threshold);
+          }
+
+          const std::uint32_t stretch = m_tick_stretch;
+          if(hot) {
+            m_tick_stretch = std::min(m_max_tick_stretch, m_tick_stretch * 2);
+            m_shedding = true;
+          } else if(calm) {
+            m_tick_stretch = std::max<std::uint32_t>(1, m_tick_stretch / 2);
+            if(m_tick_stretch == 1) m_shedding = false;
+          }
+          if(m_tick_stretch != stretch)
+            dlog::notice("Resource pressure " + std::string(hot ? "high" : "back to normal") + ", on_update() period x" + std::to_string(m_tick_stretch) + ".");
+        }
+
+        /**
+         * Watch on_update() from another thread (see dwatchdog) and log the loop thread's backtrace when a tick
+         * runs past its budget:
+         *   tick_budget_ms=5000         # 0 or unset disables it
+         *   tick_budget_abort=true      # then abort() so systemd restarts us (Restart=on-failure), default false
+         */
+        void apply_watchdog_settings(const dconfig& cfg) {
+          const long budget = std::atol(cfg.get("tick_budget_ms").c_str());
+          const std::string abort_value = cfg.get("tick_budget_abort");
+          const bool abort_when_stuck = abort_value == "true" || abort_value == "yes" || abort_value == "1";
+          if(budget <= 0) {
+            m_watchdog.stop();
+            m_tick_budget = std::chrono::milliseconds::zero();
+            return;
+          }
+          if(m_watchdog.is_running() && m_tick_budget.count() == budget && m_tick_budget_abort == abort_when_stuck)
+            return;
+          m_tick_budget = std::chrono::milliseconds(budget);
+          m_tick_budget_abort = abort_when_stuck;
+          if(m_watchdog.start(m_tick_budget, m_tick_budget_abort))
+            dlog::info("Tick budget " + std::to_string(budget) + "ms" + (abort_when_stuck ? ", aborting when stuck." : "."));
+        }
+
+        /**
+         * Defaults of the profiles started with SIGUSR2 or the control socket (see start_profile()):
+         *   profile_hz=99          # samples per second of CPU time, up to 1000
+         *   profile_seconds=30
+         */
+        void apply_profile_settings(const dconfig& cfg) {
+          const std::string hz = cfg.get("profile_hz");
+          const std::string seconds = cfg.get("profile_seconds");
+          m_profile_hz = hz.empty() ? 99 : std::atoi(hz.c_str());
+          m_profile_duration = std::chrono::seconds(seconds.empty() ? 30 : std::atol(seconds.c_str()));
+        }
+
+        /**
+         * Serve the metrics (Prometheus text format) on /metrics and is_healthy() on /healthz, over HTTP at:
+         *   metrics_listen=127.0.0.1:9100   # host:port, or a unix socket path
+         * In prefork mode each worker serves its own: at port + worker id, or at path.<worker id>.
+         * The server runs on its own thread and loop, so /healthz still answers 503 while on_update() hangs.
+         */
+        void apply_metrics_settings(const dconfig& cfg) {
+          std::string address = cfg.get("metrics_listen");
+          if(!address.empty() && m_worker_id >= 0) {
+            const std::size_t colon = address.rfind(':');
+            if(address[0] == '/' || colon == std::string::npos)
+              address += "." + std::to_string(m_worker_id);
+            else
+              address = address.substr(0, colon + 1) + std::to_string(std::atoi(address.c_str() + colon + 1) + m_worker_id);
+          }
+          if(address == m_metrics_listen) return;
+          m_metrics_listen = address;
+          stop_http();
+          if(address.empty()) return;
+          m_http_loop.reset(new dloop());
+          m_http.reset(new dhttp(*m_http_loop));
+          m_http->route("/metrics", [](const dhttp::request&) { return metrics_response(); });
+          m_http->route("/healthz", [this](const dhttp::request&) {
+            dhttp::response res;
+            const bool healthy = is_healthy();
+            res.status = healthy ? 200 : 503;
+            res.body = healthy ? "ok\n" : !m_is_running.load() ? "stopping\n" : m_watchdog.is_stuck() ? "tick stuck\n" : "tick overdue\n";
+            return res;
+          });
+          if(!m_http->listen(address)) {
+            stop_http();
+            m_metrics_listen.clear(); // retried on the next reload
+            return;
+          }
+          dloop* loop = m_http_loop.get();
+          m_http_thread = std::thread([this, loop]() {
+            pthread_setname_np(pthread_self(), "daemonpp-http");
+            if(m_sched_defaults_saved) dsched::apply(m_sched_defaults);
+            loop->run();
+          });
+        }
+
+        /**
+         * Stop the HTTP server's thread then close the server, on the daemon's thread.
+         */
+        void stop_http() {
+          if(m_http_thread.joinable()) {
+            dloop* loop = m_http_loop.get();
+            loop->post([loop]() { loop->stop(); });
+            m_http_thread.join();
+          }
+          m_http.reset();
+          m_http_loop.reset();
+        }
+
+        /**
+         * Serve the control socket (see dcontrol, talk to it with daemonppctl):
+         *   control_socket=/run/my_daemon/control.sock   # default /run/<name>/control.sock, none disables it
+         *   control_allow_uids=1000,1001                  # besides root and the daemon's own user
+         * In prefork mode each worker serves its own, at control.<worker id>.sock.
+         */
+        void apply_control_settings(const dconfig& cfg) {
+          std::string path = cfg.get("control_socket");
+          if(path.empty()) path = "/run/" + m_name + "/control.sock";
+          if(path == "none") {
+            m_control.close();
+            return;
+          }
+          if(m_worker_id >= 0) {
+            const std::size_t extension = path.rfind(".sock");
+            const std::string id = "." + std::to_string(m_worker_id);
+            if(extension != std::string::npos && extension + 5 == path.size()) path.insert(extension, id);
+            else path += id;
+          }
+          std::vector<uid_t> uids;
+          const std::string allowed = cfg.get("control_allow_uids");
+          for(std::size_t begin = 0; begin < allowed.size();) {
+            std::size_t end = allowed.find(',', begin);
+            if(end == std::string::npos) end = allowed.size();
+            uids.push_back(static_cast<uid_t>(std::atol(allowed.c_str() + begin)));
+            begin = end + 1;
+          }
+          m_control.set_allowed_uids(uids);
+          if(!m_control_commands_added) {
+            add_control_commands();
+            m_control_commands_added = true;
+          }
+          if(path != m_control.get_path() && m_control.listen(path))
+            dlog::info("Control socket listening on " + path + ".");
+        }
+
+        /**
+         * Built-in commands of the control socket.
+         */
+        void add_control_commands() {
+          using args_t = const std::vector<std::string>&;
+          auto add = [this](const std::string& name, const std::string& help, dcontrol::handler fn) {
+            // Commands added with add_command() before run() take precedence.
+            if(std::find(m_user_commands.begin(), m_user_commands.end(), name) == m_user_commands.end())
+              m_control.add_command(name, help, std::move(fn));
+          };
+          add("status", "pid, status, health and tick counters", [this](args_t, std::string& output) {
+            const auto ms = [](const std::chrono::nanoseconds& d) {
+              char text[32];
+              std::snprintf(text, sizeof(text), "%.3f", static_cast<double>(d.count()) / 1e6);
+              return std::string(text);
+            };
+            output = "pid " + std::to_string(getpid()) + "\nstatus " + m_status + "\nhealthy " + (is_healthy() ? "yes" : "no") +
+                     "\nticks " + std::to_string(m_tick_stats.ticks) + "\noverruns " + std::to_string(m_tick_stats.overruns) +
+                     "\nmissed " + std::to_string(m_tick_stats.missed) +
+                     "\nperiod_ms " + ms(std::chrono::duration_cast<std::chrono::nanoseconds>(m_update_duration)) + " x" + std::to_string(m_tick_stretch) +
+                     "\nlateness_ms last " + ms(m_tick_stats.last_lateness) + " max " + ms(m_tick_stats.max_lateness) +
+                     "\nshedding " + (m_shedding ? "yes" : "no") + "\n";
+            return true;
+          });
+          add("period", "[ms] show or set the on_update() period", [this](args_t args, std::string& output) {
+            if(args.size() > 1) {
+              const long ms = std::atol(args[1].c_str());
+              if(ms <= 0) {
+                output = "invalid period '" + args[1] + "'\n";
+                return false;
+              }
+              set_update_duration(std::chrono::milliseconds(ms));
+              // Bring the pending tick forward when the new period ends sooner.
+              const auto sooner = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms) * m_tick_stretch;
+              if(m_is_running.load() && sooner < m_next_tick) {
+                m_next_tick = sooner;
+                m_loop.set_timer_at(m_tick_timer, m_next_tick);
+                publish_health_deadline();
+              }
             }
-            default:
-              break;
+            output = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(m_update_duration).count()) + "\n";
+            return true;
+          });
+          add("tasks", "list the tasks: name, period and next call in ms", [this](args_t, std::string& output) {
+            for(const dscheduler::task_info& task : m_scheduler.get_tasks())
+              output += task.name + "\t" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(task.period).count()) +
+                        "\t" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(task.due_in).count()) +
+                        (task.paused ? "\tpaused\n" : "\n");
+            return true;
+          });
+          add("pause", "<task> pause a task", [this](args_t args, std::string& output) {
+            const bool ok = args.size() > 1 && pause_task(args[1]);
+            output = ok ? "paused\n" : "no such running task\n";
+            return ok;
+          });
+          add("resume", "<task> resume a paused task", [this](args_t args, std::string& output) {
+            const bool ok = args.size() > 1 && resume_task(args[1]);
+            output = ok ? "resumed\n" : "no such paused task\n";
+            return ok;
+          });
+          add("reload", "reload the configuration", [this](args_t, std::string& output) {
+            // After answering, a reload may move the control socket.
+            m_loop.post([this]() { reload(); });
+            output = "reloading\n";
+            return true;
+          });
+          add("metrics", "dump the metrics (Prometheus text format)", [](args_t, std::string& output) {
+            std::string family;
+            for(const dmetrics::sample& s : dmetrics::collect()) {
+              dmetrics::format(s, s.family() != family, output);
+              family = s.family();
+            }
+            return true;
+          });
+          add("profile", "[seconds|stop] profile the CPU usage, then write collapsed stacks", [this](args_t args, std::string& output) {
+            if(args.size() > 1 && args[1] == "stop") {
+              const std::string path = m_profile_path;
+              const bool ok = stop_profile();
+              output = ok ? "written to " + path + "\n" : "no profile running\n";
+              return ok;
+            }
+            const long seconds = args.size() > 1 ? std::atol(args[1].c_str()) : static_cast<long>(m_profile_duration.count());
+            if(seconds <= 0) {
+              output = "invalid duration '" + args[1] + "'\n";
+              return false;
+            }
+            const std::string path = start_profile(std::chrono::seconds(seconds));
+            output = path.empty() ? (m_profiler.is_running() ? "a profile is running already\n" : "could not start, see the logs\n") : "profiling for " + std::to_string(seconds) + "s into " + path + "\n";
+            return !path.empty();
+          });
+          add("loglevel", "[level] show or set the lowest priority logged (emergency..debug)", [](args_t args, std::string& output) {
+            if(args.size() > 1) {
+              const std::int32_t priority = dlog::priority_of(args[1]);
+              if(priority < 0) {
+                output = "unknown level '" + args[1] + "'\n";
+                return false;
+              }
+              dlog::set_level(priority);
+            }
+            output = dlog::priority_str(dlog::get_level()) + (dlog::get_level() > dlog::COMPILED_LEVEL ?
+                     " (" + dlog::priority_str(dlog::COMPILED_LEVEL) + " and lower compiled in)\n" : "\n");
+            return true;
+          });
+          add("upgrade", "hot upgrade to the installed binary", [this](args_t, std::string& output) {
+            const bool ok = upgrade();
+            output = ok ? "upgrading\n" : "upgrade failed, see the logs\n";
+            return ok;
+          });
+        }
+
+        /**
+         * Publish the status, tick counters and metrics in the stats segment (see dstats, read it with daemonpp-stat):
+         *   stats_interval_ms=1000          # metrics refresh period, 0 disables the segment
+         * The segment is /dev/shm/<name>.stats, /dev/shm/<name>.<worker id>.stats in prefork mode.
+         */
+        void apply_stats_settings(const dconfig& cfg) {
+          const std::string value = cfg.get("stats_interval_ms");
+          const long interval = value.empty() ? 1000 : std::atol(value.c_str());
+          if(interval <= 0) {
+            cancel_task("daemonpp.stats");
+            m_stats.close();
+            return;
+          }
+          if(!m_stats.is_open()) {
+            if(!m_stats.open(dstats::path_of(m_worker_id >= 0 ? m_name + "." + std::to_string(m_worker_id) : m_name)))
+              return;
+            m_stats.publish_status(m_is_running.load() && m_tick_stats.ticks > 0 ? "Running" : "Starting");
           }
+          m_stats.publish_metrics(dmetrics::collect());
+          add_task("daemonpp.stats", std::chrono::milliseconds(interval), [this]() { m_stats.publish_metrics(dmetrics::collect()); });
+        }
+
+        void publish_tick(const std::chrono::steady_clock::duration& update_time) noexcept {
+          dstats::tick_info tick;
+          tick.ticks = m_tick_stats.ticks;
+          tick.overruns = m_tick_stats.overruns;
+          tick.missed = m_tick_stats.missed;
+          tick.period_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(m_update_duration).count()) * m_tick_stretch;
+          tick.last_lateness_ns = static_cast<std::uint64_t>(m_tick_stats.last_lateness.count());
+          tick.max_lateness_ns = static_cast<std::uint64_t>(m_tick_stats.max_lateness.count());
+          tick.last_update_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(update_time).count());
+          tick.stretch = m_tick_stretch;
+          tick.flags = m_shedding ? dstats::SHEDDING : 0;
+          m_stats.publish_tick(tick);
+        }
+
+        /**
+         * Stream the registry's samples, a piece of about 16 KiB each time the socket is writable.
+         * Collected right here, never waiting for the daemon's thread: the shards are read with atomics, and gauge
+         * callbacks must be thread safe (see dmetrics::set_gauge_callback()).
+         * @note: called on the HTTP server's thread.
+         */
+        static dhttp::response metrics_response() {
+          dhttp::response res;
+          auto samples = std::make_shared<std::vector<dmetrics::sample>>(dmetrics::collect());
+          auto next = std::make_shared<std::size_t>(0);
+          res.content_type = "text/plain; version=0.0.4; charset=utf-8";
+          res.stream = [samples, next](std::string& piece) {
+            for(; *next < samples->size() && piece.size() < 16384; ++*next) {
+              const dmetrics::sample& s = (*samples)[*next];
+              dmetrics::format(s, *next == 0 || (*samples)[*next - 1].family() != s.family(), piece);
+            }
+            return *next < samples->size();
+          };
+          return res;
+        }
+
+        void set_pool_scheduling() {
+          const dsched::settings settings = m_worker_sched;
+          m_pool->set_thread_setup([settings](std::size_t) { dsched::apply(settings); });
         }
 
     public: // getters & setters
@@ -166,6 +851,393 @@ namespace daemonpp {
           return m_update_duration;
         }
 
+        /**
+         * Set how on_update() ticks are scheduled, see tick_policy.
+         * Use one of the fixed_rate policies when samples must stay aligned to wall clock boundaries.
+         */
+        void set_tick_policy(tick_policy policy) noexcept {
+          m_tick_policy = policy;
+        }
+        tick_policy get_tick_policy() const noexcept { return m_tick_policy; }
+
+        /**
+         * Tick counters (ticks, overruns, missed deadlines and lateness).
+         * @note: updated by the daemon's loop thread, read it from callbacks.
+         */
+        const tick_stats& get_tick_stats() const noexcept { return m_tick_stats; }
+
+        /**
+         * @return true while the cgroup or host is under CPU or memory pressure (see the pressure_* config keys):
+         * skip optional work (prefetching, compaction, verbose stats...) in your callbacks meanwhile.
+         */
+        bool is_shedding() const noexcept { return m_shedding; }
+
+        /**
+         * @return current on_update() period multiplier applied under pressure, 1 normally
+         */
+        std::uint32_t get_tick_stretch() const noexcept { return m_tick_stretch; }
+
+        /**
+         * @return true while running with the next on_update() tick not overdue by more than a period (at least
+         * a second), false while starting, stopping, when the loop is starved or the tick is stuck past tick_budget_ms.
+         * Served on /healthz, see metrics_listen.
+         * @note: thread safe.
+         */
+        bool is_healthy() const {
+          if(!m_is_running.load() || m_watchdog.is_stuck()) return false;
+          return std::chrono::steady_clock::now().time_since_epoch().count() <= m_health_deadline.load(std::memory_order_acquire);
+        }
+
+        /**
+         * The daemon's event loop, register your fds, timers and wake ups here (from on_start() for example)
+         * instead of running your own polling threads. Callbacks run on the daemon's thread between ticks.
+         */
+        dloop& get_loop() noexcept { return m_loop; }
+
+        /**
+         * Select the event loop backend, applied when run() starts.
+         * dloop::backend::io_uring batches the async operations (async_read/write/accept/fsync/timeout) with the wait
+         * in a single syscall per iteration, and falls back to epoll when the kernel lacks support (Linux 5.11+).
+         */
+        void set_loop_backend(dloop::backend backend) noexcept { m_loop_backend = backend; }
+
+    public: // memory
+        /**
+         * Lock the daemon's memory in RAM when run() starts, so it is never swapped out during quiet periods.
+         * Failures are logged (raise LimitMEMLOCK= in the .service file).
+         * @param on_fault: lock pages when first touched instead of all mapped pages at once (smaller resident size)
+         */
+        void set_memory_lock(bool lock, bool on_fault = false) noexcept {
+          m_lock_memory = lock;
+          m_lock_memory_on_fault = on_fault;
+        }
+
+        /**
+         * Fault in stack and heap reserves when run() starts, before on_start(), so the first ticks don't page fault.
+         * See darena for huge page backed buffers.
+         * @param stack_bytes: stack of the daemon's thread to touch, e.g 256 KiB
+         * @param heap_bytes: heap to map and keep for later allocations
+         */
+        void set_prefault(std::size_t stack_bytes, std::size_t heap_bytes) noexcept {
+          m_prefault_stack = stack_bytes;
+          m_prefault_heap = heap_bytes;
+        }
+
+    public: // socket activation
+        /**
+         * Listening socket passed by systemd socket activation (see systemd/daemonpp.socket.in), accept() on it
+         * from on_start() instead of binding your own: connections arriving while the daemon (re)starts are queued
+         * by the kernel instead of refused.
+         * @param name: FileDescriptorName= of the .socket unit, defaults to the .socket unit's name
+         * @return the first socket with this name, -1 if there is none (the daemon was not socket activated)
+         */
+        int get_listen_fd(const std::string& name) const {
+          for(const std::pair<std::string, int>& listen_fd : m_listen_fds)
+            if(listen_fd.first == name) return listen_fd.second;
+          return -1;
+        }
+
+        /**
+         * All the inherited listening sockets with this name (a .socket unit may have several Listen*= lines).
+         */
+        std::vector<int> get_listen_fds(const std::string& name) const {
+          std::vector<int> fds;
+          for(const std::pair<std::string, int>& listen_fd : m_listen_fds)
+            if(listen_fd.first == name) fds.push_back(listen_fd.second);
+          return fds;
+        }
+
+        /**
+         * All the inherited listening sockets as (name, fd) pairs, in the .socket units order.
+         */
+        const std::vector<std::pair<std::string, int>>& get_listen_fds() const noexcept { return m_listen_fds; }
+
+        /**
+         * Register a listening socket bound by the daemon itself, so a hot upgrade hands it over to the new process
+         * where get_listen_fd(name) returns it.
+         */
+        void add_listen_fd(const std::string& name, int fd) { m_listen_fds.emplace_back(name, fd); }
+
+    public: // prefork workers
+        /**
+         * Prefork mode: run() forks `count` worker processes, each running its own on_start()/on_update()/on_stop()
+         * and event loop, while the master process supervises them: it restarts crashed workers and forwards SIGHUP,
+         * SIGTERM, SIGINT and the other registered signals to them. Workers accept on their own SO_REUSEPORT
+         * socket (see listen_tcp()) and the kernel spreads connections among them, so a daemon scales with cores.
+         * @param count: number of workers, e.g dpool::default_size(). 0 (default) runs a single process
+         * @param affinity: CPU placement of the workers
+         * @note: call it before run(). The master never calls the callbacks, hot upgrade is not supported in this mode.
+         */
+        void set_workers(std::size_t count, worker_affinity affinity = worker_affinity::cpu) noexcept {
+          m_worker_count = count;
+          m_worker_affinity = affinity;
+        }
+
+        /**
+         * @return index of this worker process in [0, worker count), -1 when not in prefork mode
+         */
+        int get_worker_id() const noexcept { return m_worker_id; }
+
+        /**
+         * Create a non blocking TCP listening socket with SO_REUSEPORT, so that every worker can bind the same
+         * address with its own accept queue.
+         * @param host: address to bind, e.g "0.0.0.0", "::" or "127.0.0.1"
+         * @return the socket, -1 on failure (logged)
+         */
+        static int listen_tcp(const std::string& host, std::uint16_t port, int backlog = SOMAXCONN) {
+          addrinfo hints{};
+          hints.ai_family = AF_UNSPEC;
+          hints.ai_socktype = SOCK_STREAM;
+          hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST;
+          addrinfo* addresses = nullptr;
+          const int error = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+          if(error != 0) {
+            dlog::error("Invalid listen address '" + host + "': " + std::string(gai_strerror(error)));
+            return -1;
+          }
+          const int fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+          const int one = 1;
+          if(fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+             setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+             bind(fd, addresses->ai_addr, addresses->ai_addrlen) < 0 || listen(fd, backlog) < 0) {
+            dlog::error("Could not listen on " + host + ":" + std::to_string(port) + ": " + std::string(std::strerror(errno)));
+            if(fd >= 0) ::close(fd);
+            freeaddrinfo(addresses);
+            return -1;
+          }
+          freeaddrinfo(addresses);
+          return fd;
+        }
+
+    public: // hot upgrade
+        /**
+         * Zero downtime upgrade to the binary currently installed at our path (e.g. after `make install`):
+         * execs it with the same arguments and hands it the listening sockets (get_listen_fds()) and the
+         * on_upgrade_save() state over a unix socket. Once the new process' on_start() returned, it becomes the
+         * service's main process (MAINPID) and this one stops: on_stop() drains it, then it exits.
+         * If the new process fails before being ready, this one keeps running.
+         * @note: requires Type=notify (see systemd/daemonpp.service.in) for systemd to follow the new main pid.
+         * @return false if the upgrade could not start (logged)
+         */
+        bool upgrade() {
+          if(m_upgrade_pid > 0) {
+            dlog::error("An upgrade is already in progress.");
+            return false;
+          }
+          if(m_worker_count > 0) {
+            dlog::error("Hot upgrade is not supported in prefork mode.");
+            return false;
+          }
+          if(m_exe.empty()) {
+            dlog::error("Cannot upgrade, the daemon's executable path is unknown.");
+            return false;
+          }
+          int sockets[2];
+          if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+            dlog::error("Could not create upgrade socket: " + std::string(std::strerror(errno)));
+            return false;
+          }
+
+          // Prepare everything exec needs before forking: the child of a multithreaded process may only
+          // call async-signal-safe functions.
+          std::string exe = m_exe;
+          const std::string deleted = " (deleted)"; // /proc/self/exe of a replaced binary
+          if(exe.size() > deleted.size() && exe.compare(exe.size() - deleted.size(), deleted.size(), deleted) == 0)
+            exe.erase(exe.size() - deleted.size());
+          std::vector<std::string> environment;
+          for(char** variable = environ; *variable; variable++) {
+            const std::string entry = *variable;
+            // WATCHDOG_PID names us, the watchdog applies to the new process once it is the main one.
+            if(entry.compare(0, std::strlen(dupgrade::ENV_FD) + 1, std::string(dupgrade::ENV_FD) + "=") == 0 ||
+               entry.compare(0, 13, "WATCHDOG_PID=") == 0)
+              continue;
+            environment.push_back(entry);
+          }
+          environment.push_back(std::string(dupgrade::ENV_FD) + "=" + std::to_string(sockets[1]));
+          std::vector<char*> envp;
+          for(std::string& entry : environment) envp.push_back(&entry[0]);
+          envp.push_back(nullptr);
+          std::vector<char*> argv;
+          for(std::string& arg : m_argv) argv.push_back(&arg[0]);
+          argv.push_back(nullptr);
+
+          const pid_t pid = fork();
+          if(pid < 0) {
+            dlog::error("Could not fork the upgrade process: " + std::string(std::strerror(errno)));
+            ::close(sockets[0]);
+            ::close(sockets[1]);
+            return false;
+          }
+          if(pid == 0) {
+            // Keep our end across exec, and start the new binary with a clean signal mask.
+            fcntl(sockets[1], F_SETFD, 0);
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigprocmask(SIG_SETMASK, &mask, nullptr);
+            execve(exe.c_str(), argv.data(), envp.data());
+            _exit(127);
+          }
+          ::close(sockets[1]);
+          m_upgrade_fd = sockets[0];
+          m_upgrade_pid = pid;
+          dlog::info("Upgrading to " + exe + " (pid " + std::to_string(pid) + ").");
+          dnotify::status("Upgrading");
+
+          // Don't hang the loop on a new process that does not read its handover.
+          const timeval timeout{10, 0};
+          setsockopt(m_upgrade_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+          if(!dupgrade::send(m_upgrade_fd, m_listen_fds, on_upgrade_save())) {
+            abort_upgrade();
+            return false;
+          }
+          m_loop.add_fd(m_upgrade_fd, EPOLLIN | EPOLLRDHUP, [this](std::uint32_t) { on_upgrade_reply(); });
+          return true;
+        }
+
+        /**
+         * Trigger upgrade() when receiving this signal, e.g `ExecReload=/bin/kill -s SIGUSR1 $MAINPID` or `systemctl kill -s SIGUSR1`.
+         */
+        void set_upgrade_signal(std::int32_t sig) {
+          set_signal_handler(sig, [this](std::int32_t) { upgrade(); });
+        }
+
+        /**
+         * @return true while an upgrade is in progress, and while draining once handed over to the new process.
+         */
+        bool is_upgrading() const noexcept { return m_upgrade_pid > 0; }
+
+    public: // profiling
+        /**
+         * Sample the daemon's stacks (all threads) on CPU time for duration (see dprofiler), then write them as
+         * collapsed stacks to <cwd>/<name>.<pid>.<date>.folded: `flamegraph.pl my_daemon.*.folded > cpu.svg`.
+         * Also started with SIGUSR2 or the control socket's "profile" command.
+         * @return path of the profile to be written, empty if one is running already or it failed (logged)
+         */
+        std::string start_profile(const std::chrono::seconds& duration) {
+          if(m_profiler.is_running()) return "";
+          const long seconds = duration.count() > 0 ? static_cast<long>(duration.count()) : 1;
+          const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+          if(!m_profiler.start(m_profile_hz, static_cast<std::size_t>(m_profile_hz) * static_cast<std::size_t>(seconds) * threads))
+            return "";
+          char date[32];
+          const std::time_t now = std::time(nullptr);
+          std::strftime(date, sizeof(date), "%Y%m%d-%H%M%S", std::localtime(&now));
+          m_profile_path = (m_cwd == "/" ? "" : m_cwd) + "/" + m_name + "." + std::to_string(getpid()) + "." + date + ".folded";
+          const std::uint32_t generation = ++m_profile_generation;
+          m_loop.async_timeout(std::chrono::seconds(seconds), [this, generation]() {
+            if(generation == m_profile_generation && m_profiler.is_running()) stop_profile();
+          });
+          dlog::notice("Profiling for " + std::to_string(seconds) + "s at " + std::to_string(m_profiler.get_hz()) + "Hz into " + m_profile_path + ".");
+          return m_profile_path;
+        }
+
+        /**
+         * End the running profile now and write it.
+         * @return false if none was running or it could not be written
+         */
+        bool stop_profile() {
+          if(!m_profiler.is_running()) return false;
+          m_profiler.stop();
+          ++m_profile_generation;
+          if(!m_profiler.write_folded(m_profile_path)) return false;
+          dlog::notice("Profile written to " + m_profile_path + ": " + std::to_string(m_profiler.get_samples()) + " samples" +
+                       (m_profiler.get_dropped() > 0 ? ", " + std::to_string(m_profiler.get_dropped()) + " dropped." : "."));
+          return true;
+        }
+
+    public: // tasks
+        /**
+         * Add a named task called every period on the daemon's thread, next to on_update().
+         * Use it for jobs running at different rates instead of counting ticks in on_update().
+         * Adding a task with an existing name replaces it.
+         * @param name: task name, used to cancel or reschedule it
+         * @param period: duration between calls, rounded up to the scheduler resolution (1ms)
+         * @param callback: task to run
+         */
+        template<typename Rep, typename Period>
+        void add_task(const std::string& name, const std::chrono::duration<Rep, Period>& period, dscheduler::callback callback) {
+          m_scheduler.add_task(name, period, std::move(callback));
+        }
+
+        /**
+         * Add a named task called once after delay.
+         */
+        template<typename Rep, typename Period>
+        void add_oneshot_task(const std::string& name, const std::chrono::duration<Rep, Period>& delay, dscheduler::callback callback) {
+          m_scheduler.add_oneshot_task(name, delay, std::move(callback));
+        }
+
+        /**
+         * Change a task's period, the next call happens one new period from now.
+         * @return false if no task has this name
+         */
+        template<typename Rep, typename Period>
+        bool reschedule_task(const std::string& name, const std::chrono::duration<Rep, Period>& period) {
+          return m_scheduler.reschedule_task(name, period);
+        }
+
+        /**
+         * Cancel a task, safe to call from the task itself.
+         * @return false if no task has this name
+         */
+        bool cancel_task(const std::string& name) {
+          return m_scheduler.cancel_task(name);
+        }
+
+        /**
+         * Stop calling a task until resume_task().
+         * @return false if no task has this name or it is already paused
+         */
+        bool pause_task(const std::string& name) {
+          return m_scheduler.pause_task(name);
+        }
+
+        /**
+         * Resume a paused task with the time it had left when paused.
+         * @return false if no task has this name or it is not paused
+         */
+        bool resume_task(const std::string& name) {
+          return m_scheduler.resume_task(name);
+        }
+
+    public: // control socket
+        /**
+         * Add a command to the control socket (see control_socket in the config and daemonppctl), e.g:
+         *   add_command("flush", "flush the cache", [this](const std::vector<std::string>& args, std::string& output) {
+         *     output = std::to_string(m_cache.flush()) + " entries flushed\n";
+         *     return true; // false answers with an error
+         *   });
+         * @note: the command runs on the daemon's thread. Replaces a built-in command of the same name.
+         */
+        void add_command(const std::string& name, const std::string& help, dcontrol::handler fn) {
+          m_control.add_command(name, help, std::move(fn));
+          m_user_commands.push_back(name);
+        }
+
+        dscheduler& get_scheduler() noexcept { return m_scheduler; }
+
+    public: // worker pool
+        /**
+         * The daemon's work stealing thread pool, started on first use.
+         * Offload slow work from your callbacks so it does not delay the next tick:
+         *   get_pool().submit(work, [this](result r) { ... }); // continuation runs back on the daemon's thread
+         *   get_pool().parallel_for(0, items.size(), [&](std::size_t i) { process(items[i]); });
+         * @note: call it from the daemon's thread, after run() started (workers inherit the blocked signals mask).
+         */
+        dpool& get_pool() {
+          if(!m_pool) {
+            m_pool.reset(new dpool(m_pool_size, &m_loop));
+            if(m_sched_defaults_saved) set_pool_scheduling();
+          }
+          return *m_pool;
+        }
+
+        /**
+         * Set the number of pool workers, 0 (default) sizes it from the CPU quota (cgroup cpu.max and affinity).
+         * @note: must be called before the first get_pool().
+         */
+        void set_pool_size(std::size_t size) noexcept { m_pool_size = size; }
+
         void set_name(const std::string& daemon_name) noexcept {
           m_name = daemon_name;
         }
@@ -182,10 +1254,267 @@ namespace daemonpp {
         }
         const std::string& get_cwd() const noexcept { return m_cwd; }
 
+        /**
+         * Set how run() starts the process, see start_mode. Must be called before run().
+         */
+        void set_start_mode(start_mode mode) noexcept { m_start_mode = mode; }
+        start_mode get_start_mode() const noexcept { return m_start_mode; }
+
+        /**
+         * Report a free form status to systemd, shown by `systemctl status` (Type=notify only), and in the stats segment.
+         */
+        void set_status(const std::string& status) {
+          m_status = status;
+          dnotify::status(status);
+          m_stats.publish_status(status);
+        }
+
         pid_t get_pid() const noexcept { return m_pid; }
         pid_t get_sid() const noexcept { return m_sid; }
 
     private:
+        /**
+         * Publish for is_healthy() the time after which the next tick is overdue: its deadline plus a period, at least a second.
+         */
+        void publish_health_deadline() {
+          const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_update_duration) * m_tick_stretch;
+          const auto grace = std::max<std::chrono::steady_clock::duration>(period, std::chrono::seconds(1));
+          m_health_deadline.store((m_next_tick + grace).time_since_epoch().count(), std::memory_order_release);
+        }
+
+        /**
+         * Compute the deadline of the next tick according to the tick policy.
+         * @param deadline: deadline of the tick that just ran
+         */
+        std::chrono::steady_clock::time_point next_deadline(const std::chrono::steady_clock::time_point& deadline) {
+          const auto now = std::chrono::steady_clock::now();
+          const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(m_update_duration) * m_tick_stretch;
+          if(m_tick_policy == tick_policy::fixed_delay || period <= std::chrono::steady_clock::duration::zero())
+            return now + period;
+
+          auto next = deadline + period;
+          if(now < next)
+            return next;
+
+          // on_update() took longer than the period (or we were preempted), we are behind schedule.
+          m_tick_stats.overruns++;
+          const auto behind = static_cast<std::uint64_t>((now - next) / period);
+          switch(m_tick_policy) {
+            case tick_policy::fixed_rate_skip:
+              // Drop every missed deadline, including the one due now, and wait for the next one on the grid.
+              m_tick_stats.missed += behind + 1;
+              return next + period * static_cast<std::int64_t>(behind + 1);
+            case tick_policy::fixed_rate_coalesce:
+              // Run a single tick now on behalf of all the missed ones.
+              m_tick_stats.missed += behind;
+              return next + period * static_cast<std::int64_t>(behind);
+            case tick_policy::fixed_rate_burst:
+            default:
+              // Run the missed ticks back to back, deadline by deadline.
+              return next;
+          }
+        }
+
+        void record_lateness(const std::chrono::steady_clock::duration& lateness) noexcept {
+          const auto late = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(lateness), std::chrono::nanoseconds::zero());
+          m_tick_stats.last_lateness = late;
+          m_tick_stats.max_lateness = std::max(m_tick_stats.max_lateness, late);
+          m_tick_stats.total_lateness += late;
+          m_lateness_metric.record(late);
+        }
+
+        /**
+         * Prefork master: fork the workers and supervise them until stopped.
+         * @return true in the master once every worker exited, false in a worker which then runs the daemon
+         */
+        bool run_master() {
+          // The workers get the user's handlers back, the master forwards signals and reaps workers instead.
+          m_worker_handlers = m_signal_handlers;
+          for(auto& handler : m_signal_handlers) {
+            const std::int32_t sig = handler.first;
+            handler.second = [this, sig](std::int32_t) { signal_workers(sig); };
+          }
+          m_signal_handlers[SIGTERM] = m_signal_handlers[SIGINT] = [this](std::int32_t sig) {
+            m_workers_stopping = true;
+            signal_workers(sig);
+            if(alive_workers() == 0) stop();
+          };
+          // Reap the workers instead of ignoring them, to restart the crashed ones.
+          std::signal(SIGCHLD, SIG_DFL);
+          set_signal_handler(SIGCHLD, [this](std::int32_t) { reap_workers(); });
+
+          m_workers.assign(m_worker_count, worker{});
+          for(std::size_t id = 0; id < m_worker_count; id++)
+            if(!spawn_worker(id)) return false; // we are the worker
+          dlog::info("Started " + std::to_string(m_worker_count) + " workers.");
+
+          m_is_running = true;
+          dnotify::ready();
+          dnotify::status("Supervising " + std::to_string(m_worker_count) + " workers");
+          const std::chrono::microseconds watchdog_interval = dnotify::watchdog_interval();
+          if(watchdog_interval > std::chrono::microseconds::zero())
+            m_master_timers.push_back(m_loop.add_timer(watchdog_interval / 2, []() { dnotify::watchdog(); }, watchdog_interval / 2));
+          while(m_is_running.load()) {
+            m_loop.run_once(-1);
+            // Restart workers here rather than from the SIGCHLD or timer callbacks: the worker must not return into
+            // the master's stack, amid its batch of signals or epoll events.
+            for(std::size_t id = 0; id < m_workers.size(); id++) {
+              if(!m_workers[id].restart) continue;
+              m_workers[id].restart = false;
+              if(!m_workers_stopping && !spawn_worker(id)) return false; // we are the restarted worker
+            }
+          }
+          dnotify::stopping();
+          return true;
+        }
+
+        /**
+         * Fork worker `id`.
+         * @return true in the master, false in the new worker
+         */
+        bool spawn_worker(std::size_t id) {
+          const pid_t pid = fork();
+          if(pid < 0) {
+            dlog::error("Could not fork worker " + std::to_string(id) + ": " + std::string(std::strerror(errno)));
+            schedule_worker_restart(id);
+            return true;
+          }
+          if(pid > 0) {
+            m_workers[id].pid = pid;
+            m_workers[id].started = std::chrono::steady_clock::now();
+            return true;
+          }
+
+          m_worker_id = static_cast<int>(id);
+          // Die with the master, then detach from its loop, timers and signalfd.
+          prctl(PR_SET_PDEATHSIG, SIGTERM);
+          if(getppid() != m_pid) _exit(EXIT_FAILURE); // the master died before prctl()
+          m_pid = getpid();
+          m_loop.after_fork();
+          for(int timer : m_master_timers) m_loop.remove_timer(timer);
+          m_master_timers.clear();
+          m_loop.remove_fd(m_signal_fd);
+          ::close(m_signal_fd);
+          m_signal_fd = -1;
+          m_signal_handlers = m_worker_handlers;
+          std::signal(SIGCHLD, SIG_IGN);
+          watch_signals();
+          m_workers.clear();
+          // systemd only listens to the master (NotifyAccess=main).
+          dnotify::shutdown();
+          unsetenv("NOTIFY_SOCKET");
+          unsetenv("WATCHDOG_USEC");
+          pin_worker(id);
+          return false;
+        }
+
+        void signal_workers(std::int32_t sig) {
+          for(const worker& w : m_workers)
+            if(w.pid > 0) kill(w.pid, sig);
+        }
+
+        std::size_t alive_workers() const {
+          return static_cast<std::size_t>(std::count_if(m_workers.begin(), m_workers.end(), [](const worker& w) { return w.pid > 0; }));
+        }
+
+        void reap_workers() {
+          int status = 0;
+          pid_t pid;
+          while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto it = std::find_if(m_workers.begin(), m_workers.end(), [pid](const worker& w) { return w.pid == pid; });
+            if(it == m_workers.end()) continue;
+            const std::size_t id = static_cast<std::size_t>(it - m_workers.begin());
+            it->pid = -1;
+            if(m_workers_stopping) continue;
+            if(WIFSIGNALED(status))
+              dlog::error("Worker " + std::to_string(id) + " killed by signal " + std::to_string(WTERMSIG(status)) + ", restarting it.");
+            else
+              dlog::error("Worker " + std::to_string(id) + " exited with status " + std::to_string(WEXITSTATUS(status)) + ", restarting it.");
+            // Crashing right at start up: don't fork in a tight loop.
+            if(std::chrono::steady_clock::now() - it->started < std::chrono::seconds(1))
+              schedule_worker_restart(id);
+            else
+              it->restart = true; // forked by run_master()
+          }
+          if(m_workers_stopping && alive_workers() == 0) stop();
+        }
+
+        void schedule_worker_restart(std::size_t id) {
+          std::shared_ptr<int> timer = std::make_shared<int>(-1);
+          *timer = m_loop.add_timer(std::chrono::seconds(1), [this, id, timer]() {
+            m_master_timers.erase(std::remove(m_master_timers.begin(), m_master_timers.end(), *timer), m_master_timers.end());
+            m_loop.remove_timer(*timer);
+            if(!m_workers_stopping) m_workers[id].restart = true;
+          });
+          m_master_timers.push_back(*timer);
+        }
+
+        /**
+         * Pin the calling worker according to the worker affinity, within the CPUs allowed to the daemon.
+         */
+        void pin_worker(std::size_t id) {
+          if(m_worker_affinity == worker_affinity::none) return;
+          cpu_set_t allowed;
+          CPU_ZERO(&allowed);
+          if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return;
+          std::vector<int> allowed_cpus;
+          for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if(CPU_ISSET(cpu, &allowed)) allowed_cpus.push_back(cpu);
+          if(allowed_cpus.empty()) return;
+
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          if(m_worker_affinity == worker_affinity::numa_node) {
+            std::vector<std::vector<int>> nodes;
+            for(int node = 0; ; node++) {
+              std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+              std::string list;
+              if(!(cpulist >> list)) break;
+              std::vector<int> cpus;
+              for(int cpu : dsched::parse_cpu_list(list))
+                if(CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+              if(!cpus.empty()) nodes.push_back(cpus);
+            }
+            if(nodes.empty()) nodes.push_back(allowed_cpus); // no NUMA information, a single node
+            for(int cpu : nodes[id % nodes.size()]) CPU_SET(cpu, &set);
+          } else {
+            CPU_SET(allowed_cpus[id % allowed_cpus.size()], &set);
+          }
+          if(sched_setaffinity(0, sizeof(set), &set) < 0) {
+            dlog::error("Could not pin worker " + std::to_string(id) + ": " + std::string(std::strerror(errno)));
+            return;
+          }
+          // Reloads restore this mask, not the master's.
+          m_sched_defaults.has_affinity = true;
+          m_sched_defaults.affinity = set;
+          m_worker_pinned = true;
+        }
+
+        void on_upgrade_reply() {
+          char reply = 0;
+          const ssize_t n = ::read(m_upgrade_fd, &reply, 1);
+          if(n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+          if(n != 1 || reply != dupgrade::READY) {
+            dlog::error("Upgrade failed, the new process exited before being ready. Keep running.");
+            abort_upgrade();
+            return;
+          }
+          m_loop.remove_fd(m_upgrade_fd);
+          ::close(m_upgrade_fd);
+          m_upgrade_fd = -1;
+          dlog::info("Upgraded process " + std::to_string(m_upgrade_pid) + " is ready, draining.");
+          dnotify::notify("MAINPID=" + std::to_string(m_upgrade_pid) + "\nREADY=1");
+          stop();
+        }
+
+        void abort_upgrade() {
+          m_loop.remove_fd(m_upgrade_fd);
+          ::close(m_upgrade_fd);
+          m_upgrade_fd = -1;
+          m_upgrade_pid = -1;
+          dnotify::status("Running");
+        }
+
         /**
          * Daemonize this program
          * @note: It is also possible to use glibc function deamon()
@@ -193,18 +1522,24 @@ namespace daemonpp {
          * for example handle signals, set working directory..
          */
         void daemonize() {
-          // Fork off the parent process https://linux.die.net/man/3/fork
-          m_pid = fork();
-          // Success: The parent process continues with a process ID greater than 0
-          if (m_pid > 0) {
-            std::exit(EXIT_SUCCESS);
-          }
-          // An error occurred. A process ID lower than 0 indicates a failure in either process
-          else if (m_pid < 0) {
-            std::exit(EXIT_FAILURE);
+          // The new process of a hot upgrade is already detached.
+          const bool forking = !m_upgraded && (m_start_mode == start_mode::forking ||
+                               (m_start_mode == start_mode::automatic && !dnotify::is_enabled()));
+          if(forking) {
+            // Fork off the parent process https://linux.die.net/man/3/fork
+            m_pid = fork();
+            // Success: The parent process continues with a process ID greater than 0
+            if (m_pid > 0) {
+              std::exit(EXIT_SUCCESS);
+            }
+            // An error occurred. A process ID lower than 0 indicates a failure in either process
+            else if (m_pid < 0) {
+              std::exit(EXIT_FAILURE);
+            }
+            // The parent process has now terminated, and the forked child process will continue
+            // (the pid of the child process was 0)
           }
-          // The parent process has now terminated, and the forked child process will continue
-          // (the pid of the child process was 0)
+          m_pid = getpid();
 
           // Since the child process is a daemon, the umask needs to be set so files and logs can be written
           umask(0);
@@ -214,7 +1549,8 @@ namespace daemonpp {
           //dlog::notice("Daemon '" + m_name + "' started successfully.");
 
           // On success: The child process becomes session leader. Generate a session ID for the child process
-          m_sid = setsid();
+          // (in notify mode systemd already started us as a session leader).
+          m_sid = forking ? setsid() : getsid(0);
           if (m_sid < 0) {
             dlog::error("Could not set SID to child process: " + std::string(std::strerror(errno)));
             std::exit(EXIT_FAILURE);
@@ -222,12 +1558,10 @@ namespace daemonpp {
 
           // Ignore the Child terminated or stopped signal.
           std::signal(SIGCHLD, SIG_IGN);
-          // Set signal handlers to detect daemon interrupt, restart..
-          std::signal(SIGHUP, signal_handler);
+          // Route signals to detect daemon interrupt, reload.. through a signalfd served by the event loop.
           // when a sudo systemctl stop my_daemon.service is ran, by default,
-          // a SIGTERM is sent, followed by 90 seconds of waiting followed by a SIGKILL.
-          std::signal(SIGTERM, signal_handler); // if ran: sudo systemctl stop my_daemon.service
-          std::signal(SIGKILL, signal_handler); // if ran: sudo systemctl stop my_daemon.service (after 90 seconds)
+          // a SIGTERM is sent, followed by 90 seconds of waiting followed by a SIGKILL (which can't be handled).
+          watch_signals();
 
           // Change the current working directory to a directory guaranteed to exist, provided by the user
           if(chdir(m_cwd.c_str()) < 0)
@@ -238,10 +1572,16 @@ namespace daemonpp {
             std::exit(EXIT_FAILURE);
           }
 
+          // Pin and prioritize the daemon's thread (and the pool's threads) as configured, to keep tick jitter low.
+          apply_scheduling(dconfig::from_file(m_config_file));
+
           // A daemon cannot use the terminal, so close standard file descriptors for security reasons
-          close(STDIN_FILENO);
-          close(STDOUT_FILENO);
-          close(STDERR_FILENO);
+          // (in notify mode systemd already connected them to /dev/null and the journal).
+          if(forking) {
+            close(STDIN_FILENO);
+            close(STDOUT_FILENO);
+            close(STDERR_FILENO);
+          }
         }
 
     private:
@@ -252,9 +1592,75 @@ namespace daemonpp {
         std::string m_cwd;
         std::chrono::high_resolution_clock::duration m_update_duration;
         std::atomic<bool> m_is_running;
-        std::condition_variable m_update_cv;
-        std::mutex m_mutex;
+        start_mode m_start_mode{start_mode::automatic};
+        dloop m_loop;
+        dloop::backend m_loop_backend{dloop::backend::epoll};
+        dscheduler m_scheduler{m_loop};
+        std::unique_ptr<dpool> m_pool;
+        std::size_t m_pool_size{0};
+        int m_tick_timer{-1};
+        bool m_tick_due{false};
+        int m_signal_fd{-1};
+        std::map<std::int32_t, signal_callback> m_signal_handlers;
+        std::vector<std::pair<std::string, int>> m_listen_fds;
+        std::vector<std::string> m_argv;
+        std::string m_exe;
+        int m_upgrade_fd{-1};
+        pid_t m_upgrade_pid{-1};
+        bool m_upgraded{false};
+        struct worker {
+          pid_t pid{-1};
+          std::chrono::steady_clock::time_point started{};
+          bool restart{false}; // forked again by run_master() between two loop iterations
+        };
+        std::size_t m_worker_count{0};
+        worker_affinity m_worker_affinity{worker_affinity::cpu};
+        std::vector<worker> m_workers;
+        std::map<std::int32_t, signal_callback> m_worker_handlers;
+        std::vector<int> m_master_timers;
+        int m_worker_id{-1};
+        bool m_workers_stopping{false};
+        dsched::settings m_sched_defaults{};
+        dsched::settings m_worker_sched{};
+        bool m_sched_defaults_saved{false};
+        bool m_worker_pinned{false};
+        double m_cpu_pressure_threshold{0.0};
+        double m_memory_pressure_threshold{0.0};
+        double m_memory_usage_threshold{0.0};
+        std::uint32_t m_max_tick_stretch{4};
+        std::uint32_t m_tick_stretch{1};
+        bool m_shedding{false};
+        bool m_lock_memory{false};
+        bool m_lock_memory_on_fault{false};
+        std::size_t m_prefault_stack{0};
+        std::size_t m_prefault_heap{0};
         std::int32_t m_exit_code;
+        tick_policy m_tick_policy{tick_policy::fixed_delay};
+        tick_stats m_tick_stats{};
+        std::chrono::steady_clock::time_point m_next_tick{};
+        std::atomic<std::chrono::steady_clock::rep> m_health_deadline{0};
+        std::unique_ptr<dloop> m_http_loop;
+        std::unique_ptr<dhttp> m_http;
+        std::thread m_http_thread;
+        std::string m_metrics_listen;
+        dstats m_stats;
+        std::string m_status{"Starting"};
+        dcontrol m_control{m_loop};
+        std::vector<std::string> m_user_commands;
+        bool m_control_commands_added{false};
+        dwatchdog m_watchdog;
+        std::chrono::milliseconds m_tick_budget{0};
+        bool m_tick_budget_abort{false};
+        dprofiler m_profiler;
+        std::string m_profile_path;
+        std::uint32_t m_profile_generation{0};
+        int m_profile_hz{99};
+        std::chrono::seconds m_profile_duration{30};
+        bool m_log_journal{false};
+        // Built-in series, see dmetrics
+        dmetrics::histogram& m_update_duration_metric{dmetrics::get_histogram("daemonpp_update_duration_seconds", "on_update() run time", 1e-9)};
+        dmetrics::histogram& m_lateness_metric{dmetrics::get_histogram("daemonpp_tick_lateness_seconds", "Delay between a tick's deadline and its on_update() call", 1e-9)};
+        dmetrics::counter& m_reloads_metric{dmetrics::get_counter("daemonpp_reloads_total", "Configuration reloads")};
     };
    daemon* daemon::instance = nullptr;
 } // !namespace daemonpp
@@ -0,0 +1,149 @@
+#pragma once
+#include <sched.h>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+
+namespace daemonpp {
+  /**
+   * Resource limits and pressure of the daemon's cgroup v2 (containers, systemd slices):
+   * CPU quota (cpu.max), memory limit (memory.max) and pressure stall information (PSI).
+   */
+  class dcgroup {
+    public:
+        /// PSI averages in percent of wall time where some (or all) tasks stalled on the resource
+        struct pressure {
+          double some_avg10{0.0};
+          double some_avg60{0.0};
+          double full_avg10{0.0};
+          double full_avg60{0.0};
+        };
+
+    public:
+        /**
+         * cgroup v2 path of this process, e.g "/system.slice/my_daemon.service", empty without cgroup v2.
+         */
+        static std::string path() {
+          // cgroup v2: /proc/self/cgroup has a single "0::/path" line
+          std::ifstream cgroup("/proc/self/cgroup");
+          std::string line, path;
+          while(std::getline(cgroup, line))
+            if(line.compare(0, 3, "0::") == 0) path = line.substr(3);
+          return path;
+        }
+
+        /**
+         * CPU quota in CPUs (cpu.max "<quota|max> <period>"), the smallest among the cgroup and its ancestors.
+         * @return 0 if unlimited
+         */
+        static double cpu_limit() {
+          double limit = 0.0;
+          for_each_ancestor([&limit](const std::string& dir) {
+            std::ifstream max_file(dir + "/cpu.max");
+            std::string quota;
+            double period = 0.0;
+            if(max_file >> quota >> period && quota != "max" && period > 0.0) {
+              const double cpus = std::stod(quota) / period;
+              if(limit == 0.0 || cpus < limit) limit = cpus;
+            }
+          });
+          return limit;
+        }
+
+        /**
+         * Number of CPUs this process may use: min(CPUs in the affinity mask, ceil(cpu_limit())), at least 1.
+         */
+        static std::size_t available_cpus() {
+          std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          if(sched_getaffinity(0, sizeof(set), &set) == 0)
+            cpus = static_cast<std::size_t>(std::max(1, CPU_COUNT(&set)));
+          const double limit = cpu_limit();
+          if(limit > 0.0)
+            cpus = std::min(cpus, static_cast<std::size_t>(std::max(1.0, std::ceil(limit))));
+          return cpus;
+        }
+
+        /**
+         * Memory limit in bytes (memory.max), the smallest among the cgroup and its ancestors.
+         * @return 0 if unlimited
+         */
+        static std::uint64_t memory_limit() {
+          std::uint64_t limit = 0;
+          for_each_ancestor([&limit](const std::string& dir) {
+            std::ifstream max_file(dir + "/memory.max");
+            std::string value;
+            if(max_file >> value && value != "max") {
+              const std::uint64_t bytes = std::stoull(value);
+              if(limit == 0 || bytes < limit) limit = bytes;
+            }
+          });
+          return limit;
+        }
+
+        /**
+         * Memory used by the cgroup in bytes (memory.current), 0 if unknown.
+         */
+        static std::uint64_t memory_usage() {
+          const std::string cgroup = path();
+          if(cgroup.empty()) return 0;
+          std::ifstream current_file(root(cgroup) + "/memory.current");
+          std::uint64_t bytes = 0;
+          current_file >> bytes;
+          return bytes;
+        }
+
+        /**
+         * Pressure of a resource for the cgroup ("<cgroup>/cpu.pressure"), or system wide ("/proc/pressure/cpu")
+         * when the cgroup has none.
+         * @param resource: "cpu", "memory" or "io"
+         * @return false if PSI is not available (Linux 4.20+, CONFIG_PSI)
+         */
+        static bool read_pressure(const std::string& resource, pressure& p) {
+          const std::string cgroup = path();
+          std::ifstream file;
+          if(!cgroup.empty()) file.open(root(cgroup) + "/" + resource + ".pressure");
+          if(!file.is_open()) file.open("/proc/pressure/" + resource);
+          if(!file.is_open()) return false;
+          // some avg10=1.40 avg60=1.39 avg300=1.31 total=35548665
+          // full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+          std::string line;
+          bool found = false;
+          while(std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string kind, field;
+            fields >> kind;
+            double avg10 = 0.0, avg60 = 0.0;
+            while(fields >> field) {
+              if(field.compare(0, 6, "avg10=") == 0) avg10 = std::stod(field.substr(6));
+              else if(field.compare(0, 6, "avg60=") == 0) avg60 = std::stod(field.substr(6));
+            }
+            if(kind == "some") { p.some_avg10 = avg10; p.some_avg60 = avg60; found = true; }
+            else if(kind == "full") { p.full_avg10 = avg10; p.full_avg60 = avg60; }
+          }
+          return found;
+        }
+
+    private:
+        static std::string root(const std::string& cgroup) {
+          return "/sys/fs/cgroup" + (cgroup == "/" ? std::string() : cgroup);
+        }
+
+        template<typename F>
+        static void for_each_ancestor(F&& fn) {
+          std::string cgroup = path();
+          if(cgroup.empty()) return;
+          for(;;) {
+            fn(root(cgroup));
+            if(cgroup == "/" || cgroup.empty()) break;
+            const std::size_t slash = cgroup.find_last_of('/');
+            cgroup = slash == 0 ? "/" : cgroup.substr(0, slash);
+          }
+        }
+  };
+} // !namespace daemonpp
@@ -0,0 +1,315 @@
+#pragma once
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "dlog.hpp"
+#include "dloop.hpp"
+
+namespace daemonpp {
+  /**
+   * Admin control socket served by a dloop: a unix stream socket taking one command per line,
+   * e.g "period 500" or "pause my_task", and answering each with a header line then the output:
+   *
+   *   OK <size>\n<size bytes of output>
+   *   ERR <size>\n<size bytes of error message>
+   *
+   * Clients are authenticated with SO_PEERCRED: root, the daemon's own user and the allowed uids only.
+   */
+  class dcontrol {
+    public:
+        /// Run a command, args[0] being its name. Return false to answer ERR with output as the error message.
+        using handler = std::function<bool(const std::vector<std::string>& args, std::string& output)>;
+
+    public:
+        explicit dcontrol(dloop& loop) : m_loop(loop) {
+          add_command("help", "list the commands", [this](const std::vector<std::string>&, std::string& output) {
+            for(const auto& command : m_commands)
+              output += command.first + (command.second.help.empty() ? "" : "\t" + command.second.help) + "\n";
+            return true;
+          });
+        }
+
+        dcontrol(const dcontrol&) = delete;
+        dcontrol& operator=(const dcontrol&) = delete;
+
+        ~dcontrol() { close(); }
+
+        /**
+         * Start serving at path, creating its directory if needed.
+         * @param mode: socket file permissions, connecting needs write permission
+         * @return false on failure (logged)
+         */
+        bool listen(const std::string& path, mode_t mode = 0660) {
+          close();
+          sockaddr_un address{};
+          if(path.size() >= sizeof(address.sun_path)) {
+            dlog::error("Control socket path '" + path + "' is too long.");
+            return false;
+          }
+          const std::size_t slash = path.find_last_of('/');
+          if(slash != std::string::npos && slash > 0 && mkdir(path.substr(0, slash).c_str(), 0755) < 0 && errno != EEXIST) {
+            dlog::error("Could not create the control socket directory of " + path + ": " + std::string(std::strerror(errno)));
+            return false;
+          }
+          address.sun_family = AF_UNIX;
+          std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+          ::unlink(path.c_str()); // left over by a previous run
+          const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+          struct stat st{};
+          if(fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+             chmod(path.c_str(), mode) < 0 || ::stat(path.c_str(), &st) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+            dlog::error("Could not listen on control socket " + path + ": " + std::string(std::strerror(errno)));
+            if(fd >= 0) ::close(fd);
+            return false;
+          }
+          if(!m_loop.add_fd(fd, EPOLLIN, [this](std::uint32_t) { accept_connections(); })) {
+            ::close(fd);
+            return false;
+          }
+          m_listen_fd = fd;
+          m_path = path;
+          m_socket_dev = st.st_dev;
+          m_socket_ino = st.st_ino;
+          return true;
+        }
+
+        /**
+         * Stop serving, drop the connections and remove the socket file, unless another process bound a socket
+         * at the same path since (the new process of a hot upgrade).
+         */
+        void close() {
+          while(!m_connections.empty())
+            close_connection(m_connections.begin()->first);
+          if(m_listen_fd < 0) return;
+          m_loop.remove_fd(m_listen_fd);
+          ::close(m_listen_fd);
+          m_listen_fd = -1;
+          struct stat st{};
+          if(::stat(m_path.c_str(), &st) == 0 && st.st_dev == m_socket_dev && st.st_ino == m_socket_ino)
+            ::unlink(m_path.c_str());
+          m_path.clear();
+        }
+
+        /**
+         * Add (or replace) a command, called on the loop's thread.
+         * @param help: one line description shown by "help"
+         */
+        void add_command(const std::string& name, const std::string& help, handler fn) {
+          m_commands[name] = command{help, std::move(fn)};
+        }
+
+        /**
+         * Also accept the clients running as these users, besides root and the daemon's own user.
+         */
+        void set_allowed_uids(const std::vector<uid_t>& uids) { m_allowed_uids = uids; }
+
+        const std::string& get_path() const noexcept { return m_path; }
+
+        /**
+         * Client side: send a command and wait for its answer.
+         * @param output: the command's output, or the error message
+         * @return false if the command failed or the daemon could not be reached
+         */
+        static bool call(const std::string& path, const std::string& line, std::string& output) {
+          output.clear();
+          sockaddr_un address{};
+          if(path.size() >= sizeof(address.sun_path)) {
+            output = "socket path is too long";
+            return false;
+          }
+          address.sun_family = AF_UNIX;
+          std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+          const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+          if(fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            output = path + ": " + std::strerror(errno);
+            if(fd >= 0) ::close(fd);
+            return false;
+          }
+          const std::string request = line + "\n";
+          std::string answer;
+          // A refused client still reads why, even when the daemon closed before reading the request.
+          write_all(fd, request);
+          char buffer[4096];
+          std::size_t header_end = std::string::npos, size = 0;
+          for(;;) {
+            const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            answer.append(buffer, static_cast<std::size_t>(n));
+            if(header_end == std::string::npos && (header_end = answer.find('\n')) != std::string::npos)
+              size = std::strtoul(answer.c_str() + answer.find(' ') + 1, nullptr, 10);
+            if(header_end != std::string::npos && answer.size() >= header_end + 1 + size) break;
+          }
+          ::close(fd);
+          if(header_end == std::string::npos || answer.size() < header_end + 1 + size) {
+            output = "connection closed by the daemon";
+            return false;
+          }
+          output = answer.substr(header_end + 1, size);
+          return answer.compare(0, 3, "OK ") == 0;
+        }
+
+    private:
+        static constexpr std::size_t MAX_LINE = 4096;
+
+        struct command {
+          std::string help;
+          handler fn;
+        };
+
+        struct connection {
+          std::string in;
+          std::string out;
+          bool close_after{false};
+          std::uint32_t events{EPOLLIN};
+        };
+
+        void accept_connections() {
+          for(;;) {
+            const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0) {
+              if(errno == EINTR || errno == ECONNABORTED) continue;
+              if(errno != EAGAIN && errno != EWOULDBLOCK)
+                dlog::error("Could not accept control connection: " + std::string(std::strerror(errno)));
+              return;
+            }
+            ucred peer{};
+            socklen_t length = sizeof(peer);
+            if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) < 0 || !is_allowed(peer.uid)) {
+              dlog::warning("Control connection refused for pid " + std::to_string(peer.pid) + " uid " + std::to_string(peer.uid) + ".");
+              const std::string answer = reply(false, "permission denied\n");
+              if(::send(fd, answer.data(), answer.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {}
+              ::close(fd);
+              continue;
+            }
+            if(!m_loop.add_fd(fd, EPOLLIN, [this, fd](std::uint32_t events) { on_event(fd, events); })) {
+              ::close(fd);
+              continue;
+            }
+            m_connections[fd] = std::unique_ptr<connection>(new connection());
+          }
+        }
+
+        bool is_allowed(uid_t uid) const {
+          if(uid == 0 || uid == geteuid()) return true;
+          for(uid_t allowed : m_allowed_uids)
+            if(uid == allowed) return true;
+          return false;
+        }
+
+        void on_event(int fd, std::uint32_t events) {
+          auto it = m_connections.find(fd);
+          if(it == m_connections.end()) return;
+          connection& c = *it->second;
+          if(events & (EPOLLERR | EPOLLHUP)) {
+            close_connection(fd);
+            return;
+          }
+          if(events & EPOLLIN) {
+            char buffer[4096];
+            for(;;) {
+              const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+              if(n > 0) {
+                c.in.append(buffer, static_cast<std::size_t>(n));
+                continue;
+              }
+              if(n < 0 && errno == EINTR) continue;
+              if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                // The client may shut its side down after its last command, still answer it.
+                c.close_after = true;
+              }
+              break;
+            }
+            std::vector<std::string> lines;
+            std::size_t end;
+            while((end = c.in.find('\n')) != std::string::npos) {
+              lines.push_back(c.in.substr(0, end));
+              c.in.erase(0, end + 1);
+            }
+            if(c.in.size() > MAX_LINE) {
+              c.in.clear();
+              c.close_after = true;
+            }
+            const bool too_long = c.close_after && lines.empty();
+            std::string answers;
+            for(const std::string& line : lines)
+              answers += run(line);
+            if(too_long) answers += reply(false, "command too long\n");
+            // A command may have closed the server (e.g a reload moving the socket) and this connection with it.
+            if(m_connections.find(fd) == m_connections.end()) return;
+            c.out += answers;
+          }
+          // Write what the socket takes, the rest on EPOLLOUT.
+          while(!c.out.empty()) {
+            const ssize_t n = ::send(fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if(n < 0) {
+              if(errno == EINTR) continue;
+              if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+              close_connection(fd);
+              return;
+            }
+            c.out.erase(0, static_cast<std::size_t>(n));
+          }
+          if(c.out.empty() && c.close_after) {
+            close_connection(fd);
+            return;
+          }
+          const std::uint32_t wanted = c.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+          if(wanted != c.events && m_loop.modify_fd(fd, wanted)) c.events = wanted;
+        }
+
+        std::string run(const std::string& line) {
+          std::vector<std::string> args;
+          std::istringstream words(line);
+          std::string word;
+          while(words >> word) args.push_back(word);
+          if(args.empty()) return reply(false, "empty command, try help\n");
+          auto it = m_commands.find(args[0]);
+          if(it == m_commands.end()) return reply(false, "unknown command '" + args[0] + "', try help\n");
+          std::string output;
+          const bool ok = it->second.fn(args, output);
+          return reply(ok, output);
+        }
+
+        static std::string reply(bool ok, const std::string& output) {
+          return (ok ? "OK " : "ERR ") + std::to_string(output.size()) + "\n" + output;
+        }
+
+        static bool write_all(int fd, const std::string& data) {
+          std::size_t sent = 0;
+          while(sent < data.size()) {
+            const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            sent += static_cast<std::size_t>(n);
+          }
+          return true;
+        }
+
+        void close_connection(int fd) {
+          m_loop.remove_fd(fd);
+          ::close(fd);
+          m_connections.erase(fd);
+        }
+
+    private:
+        dloop& m_loop;
+        int m_listen_fd{-1};
+        std::string m_path;
+        dev_t m_socket_dev{0};  // socket file we bound, see close()
+        ino_t m_socket_ino{0};
+        std::map<std::string, command> m_commands;
+        std::vector<uid_t> m_allowed_uids;
+        std::map<int, std::unique_ptr<connection>> m_connections;
+  };
+} // !namespace daemonpp
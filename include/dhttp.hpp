@@ -0,0 +1,432 @@
+#pragma once
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include "dlog.hpp"
+#include "dloop.hpp"
+
+namespace daemonpp {
+  /**
+   * Minimal HTTP/1.1 server driven by a dloop, for local endpoints such as /metrics and /healthz.
+   * GET and HEAD only, keep-alive and pipelining, no request bodies and no TLS.
+   * Streamed responses are produced piece by piece each time the socket is writable (chunked encoding),
+   * so a large response never holds the loop longer than building one piece.
+   */
+  class dhttp {
+    public:
+        struct request {
+          std::string method;
+          std::string path;  ///< target without the query string
+          std::string query; ///< after '?', empty if none
+        };
+
+        struct response {
+          int status{200};
+          std::string content_type{"text/plain; charset=utf-8"};
+          std::string body;
+          /// When set, the body is streamed instead: called when the socket is writable, appends the next piece
+          /// to its argument and returns false once the body is complete.
+          std::function<bool(std::string&)> stream;
+        };
+
+        using handler = std::function<response(const request&)>;
+
+    public:
+        explicit dhttp(dloop& loop) : m_loop(loop) {}
+
+        dhttp(const dhttp&) = delete;
+        dhttp& operator=(const dhttp&) = delete;
+
+        ~dhttp() { close(); }
+
+        /**
+         * Start listening.
+         * @param address: "host:port" ("127.0.0.1:9100", "[::1]:9100") or the path of a unix socket ("/run/my_daemon/metrics.sock")
+         * @return false on failure (logged)
+         */
+        bool listen(const std::string& address) {
+          close();
+          const int fd = address.compare(0, 1, "/") == 0 ? listen_unix(address) : listen_tcp(address);
+          if(fd < 0) return false;
+          if(!m_loop.add_fd(fd, EPOLLIN, [this](std::uint32_t) { accept_connections(); })) {
+            ::close(fd);
+            return false;
+          }
+          m_listen_fd = fd;
+          m_address = address;
+          m_sweep_timer = m_loop.add_timer(std::chrono::seconds(int{SWEEP_INTERVAL_S}), [this]() { close_idle(); }, std::chrono::seconds(int{SWEEP_INTERVAL_S}));
+          dlog::info("HTTP server listening on " + address + ".");
+          return true;
+        }
+
+        /**
+         * Stop listening and drop every connection.
+         */
+        void close() {
+          while(!m_connections.empty())
+            close_connection(m_connections.begin()->first);
+          if(m_sweep_timer >= 0) m_loop.remove_timer(m_sweep_timer);
+          m_sweep_timer = -1;
+          if(m_listen_fd < 0) return;
+          m_loop.remove_fd(m_listen_fd);
+          ::close(m_listen_fd);
+          m_listen_fd = -1;
+          // Only remove our own socket file: after a hot upgrade the path belongs to the new process' socket.
+          struct stat st{};
+          if(m_address.compare(0, 1, "/") == 0 && ::stat(m_address.c_str(), &st) == 0 &&
+             st.st_dev == m_socket_dev && st.st_ino == m_socket_ino)
+            ::unlink(m_address.c_str());
+          m_address.clear();
+        }
+
+        /**
+         * Serve `path` (exact match) with fn, called on the loop's thread.
+         */
+        void route(const std::string& path, handler fn) {
+          m_routes[path] = std::move(fn);
+        }
+
+        const std::string& get_address() const noexcept { return m_address; }
+
+    private:
+        static constexpr std::size_t MAX_CONNECTIONS = 128;
+        static constexpr std::size_t MAX_HEADER_SIZE = 8192;
+        static constexpr std::size_t READ_BUDGET = 64 * 1024;
+        static constexpr int SWEEP_INTERVAL_S = 5;
+        static constexpr int KEEP_ALIVE_TIMEOUT_S = 60;
+
+        struct connection {
+          std::string in;
+          std::string out;
+          std::size_t out_offset{0};
+          std::function<bool(std::string&)> stream;
+          bool chunked{false};
+          bool close_after{false};
+          std::uint32_t events{EPOLLIN};
+          std::chrono::steady_clock::time_point last_active{std::chrono::steady_clock::now()};
+        };
+
+        int listen_unix(const std::string& path) {
+          sockaddr_un address{};
+          if(path.size() >= sizeof(address.sun_path)) {
+            dlog::error("Unix socket path '" + path + "' is too long.");
+            return -1;
+          }
+          address.sun_family = AF_UNIX;
+          std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+          ::unlink(path.c_str()); // left over by a previous run
+          const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+          struct stat st{};
+          if(fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+             ::stat(path.c_str(), &st) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+            dlog::error("Could not listen on " + path + ": " + std::string(std::strerror(errno)));
+            if(fd >= 0) ::close(fd);
+            return -1;
+          }
+          m_socket_dev = st.st_dev;
+          m_socket_ino = st.st_ino;
+          return fd;
+        }
+
+        int listen_tcp(const std::string& address) {
+          const std::size_t colon = address.rfind(':');
+          if(colon == std::string::npos) {
+            dlog::error("Invalid listen address '" + address + "', expected host:port or a unix socket path.");
+            return -1;
+          }
+          std::string host = address.substr(0, colon);
+          if(host.size() > 1 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+          addrinfo hints{};
+          hints.ai_family = AF_UNSPEC;
+          hints.ai_socktype = SOCK_STREAM;
+          hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+          addrinfo* addresses = nullptr;
+          const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), address.c_str() + colon + 1, &hints, &addresses);
+          if(error != 0) {
+            dlog::error("Invalid listen address '" + address + "': " + std::string(gai_strerror(error)));
+            return -1;
+          }
+          const int fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+          const int one = 1;
+          // SO_REUSEPORT: the new process of a hot upgrade binds the address while the old one still serves it.
+          if(fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+             setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+             bind(fd, addresses->ai_addr, addresses->ai_addrlen) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+            dlog::error("Could not listen on " + address + ": " + std::string(std::strerror(errno)));
+            if(fd >= 0) ::close(fd);
+            freeaddrinfo(addresses);
+            return -1;
+          }
+          freeaddrinfo(addresses);
+          return fd;
+        }
+
+        void accept_connections() {
+          for(;;) {
+            const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0) {
+              if(errno == EINTR || errno == ECONNABORTED) continue;
+              if(errno != EAGAIN && errno != EWOULDBLOCK)
+                dlog::error("Could not accept HTTP connection: " + std::string(std::strerror(errno)));
+              return;
+            }
+            if(m_connections.size() >= MAX_CONNECTIONS || !m_loop.add_fd(fd, EPOLLIN, [this, fd](std::uint32_t events) { on_event(fd, events); })) {
+              ::close(fd);
+              continue;
+            }
+            m_connections[fd] = std::unique_ptr<connection>(new connection());
+          }
+        }
+
+        void on_event(int fd, std::uint32_t events) {
+          auto it = m_connections.find(fd);
+          if(it == m_connections.end()) return;
+          connection& c = *it->second;
+          c.last_active = std::chrono::steady_clock::now();
+          if(events & (EPOLLERR | EPOLLHUP)) {
+            close_connection(fd);
+            return;
+          }
+          if(events & EPOLLIN) {
+            char buffer[4096];
+            std::size_t budget = READ_BUDGET;
+            for(;;) {
+              const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+              if(n > 0) {
+                c.in.append(buffer, static_cast<std::size_t>(n));
+                budget -= std::min(budget, static_cast<std::size_t>(n));
+                if(budget == 0) break;
+                continue;
+              }
+              if(n < 0 && errno == EINTR) continue;
+              if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_connection(fd);
+                return;
+              }
+              break;
+            }
+          }
+          if(!serve(fd, c)) return;
+          update_events(fd, c);
+        }
+
+        /**
+         * Parse the buffered requests and write the responses, one streamed piece at most per call.
+         * @return false when the connection got closed
+         */
+        bool serve(int fd, connection& c) {
+          for(;;) {
+            if(!flush(fd, c)) return false;
+            if(c.out_offset < c.out.size()) return true; // socket full, wait for EPOLLOUT
+            if(c.stream) {
+              std::string piece;
+              const bool more = c.stream(piece);
+              if(!piece.empty()) append_body(c, piece);
+              if(!more) {
+                c.stream = nullptr;
+                if(c.chunked) c.out += "0\r\n\r\n";
+              }
+              if(!flush(fd, c)) return false;
+              // Let the loop run timers and the tick before the next piece.
+              if(c.stream || c.out_offset < c.out.size()) return true;
+            }
+            if(c.close_after) {
+              close_connection(fd);
+              return false;
+            }
+            const std::size_t end = c.in.find("\r\n\r\n");
+            if(end == std::string::npos) {
+              if(c.in.size() > MAX_HEADER_SIZE) {
+                respond_error(c, 431, "Request Header Fields Too Large");
+                continue;
+              }
+              return true;
+            }
+            const std::string head = c.in.substr(0, end);
+            c.in.erase(0, end + 4);
+            handle(c, head);
+          }
+        }
+
+        void handle(connection& c, const std::string& head) {
+          const std::size_t line_end = head.find("\r\n");
+          const std::string line = head.substr(0, line_end);
+          const std::size_t first = line.find(' ');
+          const std::size_t last = line.rfind(' ');
+          if(first == std::string::npos || last == first) {
+            respond_error(c, 400, "Bad Request");
+            return;
+          }
+          request req;
+          req.method = line.substr(0, first);
+          const std::string target = line.substr(first + 1, last - first - 1);
+          const std::string version = line.substr(last + 1);
+          const std::size_t question = target.find('?');
+          req.path = target.substr(0, question);
+          if(question != std::string::npos) req.query = target.substr(question + 1);
+
+          bool keep_alive = version == "HTTP/1.1";
+          bool has_body = false;
+          std::size_t begin = line_end == std::string::npos ? head.size() : line_end + 2;
+          while(begin < head.size()) {
+            std::size_t end = head.find("\r\n", begin);
+            if(end == std::string::npos) end = head.size();
+            const std::string header = head.substr(begin, end - begin);
+            const std::size_t colon = header.find(':');
+            const std::string name = lower(header.substr(0, colon));
+            const std::string value = colon == std::string::npos ? std::string() : lower(header.substr(colon + 1));
+            if(name == "connection") {
+              if(value.find("close") != std::string::npos) keep_alive = false;
+              else if(value.find("keep-alive") != std::string::npos) keep_alive = true;
+            } else if((name == "content-length" && std::strtoul(value.c_str(), nullptr, 10) > 0) || name == "transfer-encoding") {
+              has_body = true;
+            }
+            begin = end + 2;
+          }
+          if(version.compare(0, 5, "HTTP/") != 0) {
+            respond_error(c, 400, "Bad Request");
+            return;
+          }
+          if(has_body) {
+            respond_error(c, 413, "Payload Too Large"); // we would have to skip it to parse the next request
+            return;
+          }
+          c.close_after = !keep_alive;
+          if(req.method != "GET" && req.method != "HEAD") {
+            respond(c, req, 405, "Method Not Allowed", response{405, "text/plain; charset=utf-8", "Method Not Allowed\n", nullptr}, version);
+            return;
+          }
+          auto route = m_routes.find(req.path);
+          if(route == m_routes.end()) {
+            respond(c, req, 404, "Not Found", response{404, "text/plain; charset=utf-8", "Not Found\n", nullptr}, version);
+            return;
+          }
+          const response res = route->second(req);
+          respond(c, req, res.status, reason(res.status), res, version);
+        }
+
+        void respond(connection& c, const request& req, int status, const std::string& reason_phrase, const response& res, const std::string& version) {
+          const bool head_only = req.method == "HEAD";
+          // HTTP/1.0 clients do not know chunked encoding, their streamed body ends with the connection.
+          c.chunked = res.stream && version != "HTTP/1.0";
+          if(res.stream && !c.chunked) c.close_after = true;
+          c.out += "HTTP/1.1 " + std::to_string(status) + " " + reason_phrase + "\r\n";
+          c.out += "Content-Type: " + res.content_type + "\r\n";
+          if(status == 405) c.out += "Allow: GET, HEAD\r\n";
+          if(c.chunked) c.out += "Transfer-Encoding: chunked\r\n";
+          else if(!res.stream) c.out += "Content-Length: " + std::to_string(res.body.size()) + "\r\n";
+          c.out += c.close_after ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+          if(head_only) {
+            c.chunked = false;
+            return;
+          }
+          if(res.stream) c.stream = res.stream;
+          else c.out += res.body;
+        }
+
+        void respond_error(connection& c, int status, const std::string& reason_phrase) {
+          c.in.clear();
+          c.close_after = true;
+          request req;
+          req.method = "GET";
+          respond(c, req, status, reason_phrase, response{status, "text/plain; charset=utf-8", reason_phrase + "\n", nullptr}, "HTTP/1.1");
+        }
+
+        static void append_body(connection& c, const std::string& piece) {
+          if(!c.chunked) {
+            c.out += piece;
+            return;
+          }
+          char size[20];
+          std::snprintf(size, sizeof(size), "%zx\r\n", piece.size());
+          c.out += size;
+          c.out += piece;
+          c.out += "\r\n";
+        }
+
+        /**
+         * Write as much buffered output as the socket takes.
+         * @return false when the connection got closed
+         */
+        bool flush(int fd, connection& c) {
+          while(c.out_offset < c.out.size()) {
+            const ssize_t n = ::send(fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset, MSG_NOSIGNAL);
+            if(n < 0) {
+              if(errno == EINTR) continue;
+              if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+              close_connection(fd);
+              return false;
+            }
+            c.out_offset += static_cast<std::size_t>(n);
+          }
+          c.out.clear();
+          c.out_offset = 0;
+          return true;
+        }
+
+        void update_events(int fd, connection& c) {
+          const std::uint32_t events = EPOLLIN | (c.stream || c.out_offset < c.out.size() ? EPOLLOUT : 0u);
+          if(events != c.events && m_loop.modify_fd(fd, events)) c.events = events;
+        }
+
+        void close_connection(int fd) {
+          m_loop.remove_fd(fd);
+          ::close(fd);
+          m_connections.erase(fd);
+        }
+
+        void close_idle() {
+          const auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(int{KEEP_ALIVE_TIMEOUT_S});
+          for(auto it = m_connections.begin(); it != m_connections.end();) {
+            const int fd = it->first;
+            const bool idle = it->second->last_active < deadline;
+            ++it;
+            if(idle) close_connection(fd);
+          }
+        }
+
+        static std::string lower(std::string text) {
+          std::size_t begin = text.find_first_not_of(" \t");
+          text = begin == std::string::npos ? std::string() : text.substr(begin);
+          for(char& ch : text) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+          return text;
+        }
+
+        static std::string reason(int status) {
+          switch(status) {
+            case 200: return "OK";
+            case 204: return "No Content";
+            case 400: return "Bad Request";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 500: return "Internal Server Error";
+            case 503: return "Service Unavailable";
+            default: return "Status";
+          }
+        }
+
+    private:
+        dloop& m_loop;
+        int m_listen_fd{-1};
+        int m_sweep_timer{-1};
+        std::string m_address;
+        dev_t m_socket_dev{0};  // unix socket file we bound, see close()
+        ino_t m_socket_ino{0};
+        std::map<std::string, handler> m_routes;
+        std::map<int, std::unique_ptr<connection>> m_connections;
+  };
+} // !namespace daemonpp
@@ -5,11 +5,97 @@
 #pragma once
 
 #include <syslog.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "dlogfile.hpp"
+
+// Lowest priority compiled in (LOG_EMERG 0 .. LOG_DEBUG 7), see LOG_LEVEL in CMakeLists.txt
+#ifndef DAEMONPP_LOG_LEVEL
+#define DAEMONPP_LOG_LEVEL LOG_DEBUG
+#endif
+
+#if __cplusplus >= 202002L
+#define DAEMONPP_CONSTEVAL consteval
+#else
+#define DAEMONPP_CONSTEVAL
+#endif
 
 namespace daemonpp {
     class dlog {
+    public:
+        /// What an async log call does when the queue is full
+        enum class overflow {
+          drop,  ///< drop the message, counted and reported by the writer thread, default
+          block  ///< wait for room in the queue
+        };
+
+        /// Longest message of the async mode, longer ones are truncated
+        static constexpr std::size_t MAX_MESSAGE = 1000;
+
+        /// Lowest priority compiled in: calls of the levels past it are removed by the compiler
+        static constexpr std::int32_t COMPILED_LEVEL = DAEMONPP_LOG_LEVEL;
+
+        /// Room for a thread's set_field()s, "NAME=value\n" each
+        static constexpr std::size_t MAX_FIELDS = 256;
+
+        /// Layout version of the binary log (see start_binary()), 1 had no pid in 'F' and 'R' entries
+        static constexpr std::uint32_t BINARY_VERSION = 2;
+
+        /**
+         * Where a log call is in the source, captured by the default argument of the level functions (no macro),
+         * sent as CODE_FILE and CODE_LINE by the journal sink.
+         */
+        struct location {
+          const char* file;
+          std::uint32_t line;
+
+          /// Location of the call whose default argument this is
+          static constexpr location here(const char* file = __builtin_FILE(), std::uint32_t line = __builtin_LINE()) noexcept {
+            return location{file, line};
+          }
+        };
+
+        /**
+         * Format of the deferred formatting calls, converted from the string literal where the call is, whose location
+         * it captures. Only constant arrays convert, a pointer or a mutable buffer does not compile: the format is kept by
+         * address until the writer thread reads it. In C++20 the conversion is consteval, so the array must have static
+         * storage duration (a literal or a static constexpr array).
+         */
+        struct format_string {
+          template<std::size_t N>
+          DAEMONPP_CONSTEVAL format_string(const char (&text)[N], const char* file = __builtin_FILE(),
+                                           std::uint32_t line = __builtin_LINE()) noexcept
+            : text(text), where{file, line} {}
+
+          template<std::size_t N>
+          format_string(char (&text)[N]) = delete;
+
+          const char* text;
+          location where;
+        };
+
     public:
         /**
          * initialize the logger
@@ -25,82 +111,488 @@ namespace daemonpp {
          * @param message
          * @param priority
          */
-        static void log(const std::string &message, std::int32_t priority) {
-          syslog(priority, "%s", message.c_str());
+        static void log(const std::string &message, std::int32_t priority, location where = location::here()) {
+          if(!is_enabled(priority)) return;
+          m_pushers.fetch_add(1);
+          ring* queue = m_ring.load();
+          if(!queue) {
+            m_pushers.fetch_sub(1, std::memory_order_release);
+            syslog(priority, "%s", message.c_str());
+            return;
+          }
+          push(*queue, priority, nullptr, where, message.data(), message.size());
+          m_pushers.fetch_sub(1, std::memory_order_release);
+        }
+
+        /**
+         * Deferred formatting: log format with each {} replaced by the next argument (integers, floating points,
+         * bools, enums, pointers, C and std::strings), e.g dlog::info("Signal {} received.", sig).
+         * In async mode the call only queues the format's address and the raw arguments, no std::string is built:
+         * the writer thread formats them, or writes them as such in binary mode (see start_binary()).
+         * @note: format must be a string literal, it is kept by address.
+         * @param priority: LOG_X
+         */
+        template<typename... Args>
+        static void log_format(std::int32_t priority, format_string format, const Args&... args) {
+          if(!is_enabled(priority)) return;
+          encoder e;
+          encode(e, args...);
+          m_pushers.fetch_add(1);
+          ring* queue = m_ring.load();
+          if(!queue) {
+            m_pushers.fetch_sub(1, std::memory_order_release);
+            std::string message;
+            format_args(format.text, e.data, e.size, message);
+            syslog(priority, "%s", message.c_str());
+            return;
+          }
+          push(*queue, priority, format.text, format.where, e.data, e.size);
+          m_pushers.fetch_sub(1, std::memory_order_release);
+        }
+
+        /**
+         * Lazy message: make() (returning a string) is only called when priority is enabled, e.g
+         * dlog::debug([&]() { return "state: " + dump_state(); }), and the whole call is compiled out when
+         * priority is past COMPILED_LEVEL.
+         */
+        template<std::int32_t Priority, typename F>
+        static void log_lazy(F&& make, location where = location::here()) {
+          if(Priority > COMPILED_LEVEL || !is_enabled(Priority)) return;
+          log(std::string(make()), Priority, where);
+        }
+
+        /**
+         * @return true if messages of priority are logged: compiled in, and within the runtime level.
+         * A single relaxed atomic load, nothing at all for a constant priority past COMPILED_LEVEL.
+         */
+        static bool is_enabled(std::int32_t priority) noexcept {
+          return priority <= COMPILED_LEVEL && priority <= m_level.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Log the messages up to priority (LOG_X), LOG_DEBUG (all) by default. Lower ones cost a level check.
+         */
+        static void set_level(std::int32_t priority) noexcept { m_level.store(priority, std::memory_order_relaxed); }
+        static std::int32_t get_level() noexcept { return m_level.load(std::memory_order_relaxed); }
+
+        /**
+         * @return LOG_X priority of a name ("warning") or number ("4"), -1 if unknown
+         */
+        static std::int32_t priority_of(const std::string& name) noexcept {
+          for(std::int32_t priority = LOG_EMERG; priority <= LOG_DEBUG; priority++)
+            if(name == priority_str(priority) || name == std::to_string(priority)) return priority;
+          return -1;
+        }
+
+        /**
+         * Attach a field to the next messages of the calling thread, e.g set_field("TICK_ID", "42"), replacing its
+         * previous value. Only the journal sink sends them (see start_journal()), journalctl TICK_ID=42 finds them.
+         * @param name: journald field name, uppercase letters, digits and '_', not starting with '_' or a digit
+         * @param value: without newline
+         * @return false if name or value are invalid, or the thread's fields would exceed MAX_FIELDS
+         */
+        static bool set_field(const std::string& name, const std::string& value) {
+          if(!is_field_name(name) || value.find('\n') != std::string::npos) return false;
+          clear_field(name);
+          if(m_fields.size() + name.size() + value.size() + 2 > MAX_FIELDS) return false;
+          m_fields += name;
+          m_fields += '=';
+          m_fields += value;
+          m_fields += '\n';
+          return true;
+        }
+
+        /**
+         * Stop attaching a field set by set_field() to the calling thread's messages.
+         */
+        static void clear_field(const std::string& name) {
+          for(std::size_t at = 0; at < m_fields.size();) {
+            const std::size_t end = m_fields.find('\n', at) + 1;
+            if(m_fields.compare(at, name.size(), name) == 0 && m_fields[at + name.size()] == '=') {
+              m_fields.erase(at, end - at);
+              return;
+            }
+            at = end;
+          }
+        }
+
+        /**
+         * Format the arguments encoded by log_format(), also used to decode binary logs.
+         */
+        static void format_args(const char* format, const char* data, std::size_t size, std::string& out) {
+          std::size_t offset = 0;
+          for(const char* c = format; *c; c++) {
+            if(c[0] == '{' && c[1] == '}' && offset < size) {
+              if(!decode_arg(data, size, offset, out)) {
+                out += "...";
+                return;
+              }
+              c++;
+              continue;
+            }
+            out += *c;
+          }
+          if(offset < size && data[offset] == ARG_TRUNCATED) out += "...";
         }
 
         /**
          * debug-level messages
          * @param message
          */
-        static void debug(const std::string &message) {
-          log(message, LOG_DEBUG);
+        static void debug(const std::string &message, location where = location::here()) {
+          log(message, LOG_DEBUG, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void debug(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_DEBUG)) log_format(LOG_DEBUG, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void debug(F&& make, location where = location::here()) {
+          log_lazy<LOG_DEBUG>(make, where);
         }
 
         /**
          * informational
          * @param message
          */
-        static void info(const std::string &message) {
-          log(message, LOG_INFO);
+        static void info(const std::string &message, location where = location::here()) {
+          log(message, LOG_INFO, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void info(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_INFO)) log_format(LOG_INFO, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void info(F&& make, location where = location::here()) {
+          log_lazy<LOG_INFO>(make, where);
         }
 
         /**
          * normal but significant condition
          * @param message
          */
-        static void notice(const std::string &message) {
-          log(message, LOG_NOTICE);
+        static void notice(const std::string &message, location where = location::here()) {
+          log(message, LOG_NOTICE, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void notice(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_NOTICE)) log_format(LOG_NOTICE, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void notice(F&& make, location where = location::here()) {
+          log_lazy<LOG_NOTICE>(make, where);
         }
 
         /**
          * warning conditions
          * @param message
          */
-        static void warning(const std::string &message) {
-          log(message, LOG_WARNING);
+        static void warning(const std::string &message, location where = location::here()) {
+          log(message, LOG_WARNING, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void warning(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_WARNING)) log_format(LOG_WARNING, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void warning(F&& make, location where = location::here()) {
+          log_lazy<LOG_WARNING>(make, where);
         }
 
         /**
          * error conditions
          * @param message
          */
-        static void error(const std::string &message) {
-          log(message, LOG_ERR);
+        static void error(const std::string &message, location where = location::here()) {
+          log(message, LOG_ERR, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void error(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_ERR)) log_format(LOG_ERR, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void error(F&& make, location where = location::here()) {
+          log_lazy<LOG_ERR>(make, where);
         }
 
         /**
          * critical conditions
          * @param message
          */
-        static void critical(const std::string &message) {
-          log(message, LOG_CRIT);
+        static void critical(const std::string &message, location where = location::here()) {
+          log(message, LOG_CRIT, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void critical(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_CRIT)) log_format(LOG_CRIT, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void critical(F&& make, location where = location::here()) {
+          log_lazy<LOG_CRIT>(make, where);
         }
 
         /**
          * action must be taken immediately
          * @param message
          */
-        static void alert(const std::string &message) {
-          log(message, LOG_ALERT);
+        static void alert(const std::string &message, location where = location::here()) {
+          log(message, LOG_ALERT, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void alert(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_ALERT)) log_format(LOG_ALERT, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void alert(F&& make, location where = location::here()) {
+          log_lazy<LOG_ALERT>(make, where);
         }
 
         /**
          * system is unusable
          * @param message
          */
-        static void emergency(const std::string &message) {
-          log(message, LOG_EMERG);
+        static void emergency(const std::string &message, location where = location::here()) {
+          log(message, LOG_EMERG, where);
+        }
+
+        /// deferred formatting, see log_format()
+        template<typename Arg, typename... Args>
+        static void emergency(format_string format, const Arg& arg, const Args&... args) {
+          if(is_enabled(LOG_EMERG)) log_format(LOG_EMERG, format, arg, args...);
+        }
+
+        /// lazy message, see log_lazy()
+        template<typename F, typename = decltype(std::string(std::declval<F&>()()))>
+        static void emergency(F&& make, location where = location::here()) {
+          log_lazy<LOG_EMERG>(make, where);
+        }
+
+        /**
+         * Switch to asynchronous logging: log calls copy the message into a bounded lock-free queue (no allocation,
+         * no syscall) and a writer thread sends the queued messages to syslog in batches, so a slow or rate
+         * limiting journald no longer stalls the callers.
+         * Calling it again with other settings flushes the current queue and replaces it.
+         * @note: start it after fork(), threads do not survive it. A child forked meanwhile logs synchronously, but should
+         * not log before exec(): the writer thread may have held syslog's lock when forking.
+         * @param capacity: queued messages, rounded up to a power of 2 (each takes MAX_MESSAGE + a few bytes)
+         * @param policy: what log calls do when the queue is full
+         */
+        static void start_async(std::size_t capacity = 4096, overflow policy = overflow::drop) {
+          const std::size_t size = round_capacity(capacity);
+          ring* current = m_ring.load();
+          writer& w = get_writer();
+          if(current && current->capacity() == size && m_overflow == policy && w.binary_fd < 0 && w.journal_fd < 0 && !w.file) return;
+          stop_async();
+          start_writer(size, policy, -1, -1);
+        }
+
+        /**
+         * Switch to asynchronous binary logging (NanoLog style): the writer thread appends the records to path
+         * without formatting them, each format once (when first used) then its arguments' raw bytes per record.
+         * Read it with the daemonpp-log tool. Nothing goes to syslog meanwhile.
+         * File layout, a sequence of entries in host byte order starting with a type byte:
+         *   'H' u32 version, u32 pid, i64 time_ns           at each start, the pid's format ids restart
+         *   'F' u32 pid, u32 id, u32 size, format           first use of a format by pid
+         *   'R' u32 pid, i64 time_ns, i32 priority, u32 format id, u32 size, data
+         *       id 0: data is the message, else the arguments encoded by log_format() (see format_args())
+         * Format ids are scoped by pid: during a hot upgrade the old and the new process append to the same file.
+         * @return false if path could not be opened (logged)
+         */
+        static bool start_binary(const std::string& path, std::size_t capacity = 4096, overflow policy = overflow::drop) {
+          const std::size_t size = round_capacity(capacity);
+          ring* current = m_ring.load();
+          writer& w = get_writer();
+          if(current && current->capacity() == size && m_overflow == policy && w.binary_fd >= 0 && w.binary_path == path)
+            return true;
+          stop_async();
+          const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+          if(fd < 0) {
+            error("Could not open binary log " + path + ": " + std::string(std::strerror(errno)));
+            return false;
+          }
+          w.binary_path = path;
+          start_writer(size, policy, fd, -1);
+          return true;
+        }
+
+        /**
+         * Switch to asynchronous logging to journald in its native protocol, keeping the structure syslog() flattens:
+         * each record is a datagram of fields, MESSAGE, PRIORITY, SYSLOG_IDENTIFIER, CODE_FILE and CODE_LINE of the
+         * log call, then the calling thread's set_field()s. The writer thread sends a whole batch per sendmmsg(), a
+         * record too large for a datagram goes as a sealed memfd, as sd_journal_send() does. Nothing goes to syslog
+         * meanwhile.
+         * @param socket: journald's socket, or any datagram socket speaking the protocol, e.g a test's
+         * @return false if socket is not there (logged)
+         */
+        static bool start_journal(const std::string& socket = "/run/systemd/journal/socket", std::size_t capacity = 4096,
+                                  overflow policy = overflow::drop) {
+          const std::size_t size = round_capacity(capacity);
+          ring* current = m_ring.load();
+          writer& w = get_writer();
+          if(current && current->capacity() == size && m_overflow == policy && w.journal_fd >= 0 && w.journal_path == socket)
+            return true;
+          stop_async();
+          if(socket.empty() || socket.size() >= sizeof(w.journal_address.sun_path)) {
+            error("Invalid journal socket path '" + socket + "'.");
+            return false;
+          }
+          if(::access(socket.c_str(), W_OK) < 0) {
+            error("Could not use journal socket " + socket + ": " + std::string(std::strerror(errno)));
+            return false;
+          }
+          const int fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+          if(fd < 0) {
+            error("Could not create the journal socket: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          // Room for bursts: a full socket buffer blocks the writer thread, then fills the queue.
+          const int buffer = 8 * 1024 * 1024;
+          setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+          w.journal_address = sockaddr_un{};
+          w.journal_address.sun_family = AF_UNIX;
+          std::memcpy(w.journal_address.sun_path, socket.c_str(), socket.size() + 1);
+          w.journal_path = socket;
+          w.identifier = m_daemon_name.empty() ? std::string(program_invocation_short_name) : m_daemon_name;
+          start_writer(size, policy, -1, fd);
+          return true;
+        }
+
+        /**
+         * Switch to asynchronous logging to a rotating file (see dlogfile): the writer thread formats each message as
+         * "date time [pid] priority: message" and copies it into the mapped segment, no syscall per message.
+         * Nothing goes to syslog meanwhile.
+         * @return false if path could not be opened (logged to syslog)
+         */
+        static bool start_file(const std::string& path, const dlogfile::options& options, std::size_t capacity = 4096,
+                               overflow policy = overflow::drop) {
+          const std::size_t size = round_capacity(capacity);
+          ring* current = m_ring.load();
+          writer& w = get_writer();
+          if(current && current->capacity() == size && m_overflow == policy && w.file && w.file->get_path() == path &&
+             w.file->get_options() == options)
+            return true;
+          stop_async();
+          dlogfile* file = new dlogfile();
+          if(!file->open(path, options)) {
+            delete file;
+            return false;
+          }
+          w.file = file;
+          start_writer(size, policy, -1, -1);
+          return true;
+        }
+
+        /**
+         * Run setup on the writer thread when it starts, e.g to drop the real time policy and CPU pin it inherits
+         * from the daemon's thread. Applies to the writers started next.
+         */
+        static void set_writer_setup(std::function<void()> setup) {
+          writer& w = get_writer();
+          std::lock_guard<std::mutex> lock(w.mutex);
+          w.setup = std::move(setup);
+        }
+
+        /**
+         * Back to synchronous logging, once the queued messages are written.
+         */
+        static void stop_async() {
+          writer& w = get_writer();
+          if(!w.thread) return;
+          m_ring.store(nullptr);
+          // Quiescence: log calls that loaded the queue before are done with it once the count drops to 0,
+          // the writer still running meanwhile so that blocked ones get room.
+          while(m_pushers.load(std::memory_order_acquire) != 0) {
+            wake_writer();
+            std::this_thread::yield();
+          }
+          {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.stopping = true;
+          }
+          w.wakeup.notify_one();
+          w.thread->join();
+          delete w.thread;
+          w.thread = nullptr;
+          if(w.binary_fd >= 0) {
+            ::close(w.binary_fd);
+            w.binary_fd = -1;
+            w.binary_path.clear();
+          }
+          if(w.journal_fd >= 0) {
+            ::close(w.journal_fd);
+            w.journal_fd = -1;
+            w.journal_path.clear();
+          }
+          delete w.file; // trims the current segment
+          w.file = nullptr;
+        }
+
+        static bool is_async() noexcept { return m_ring.load() != nullptr; }
+
+        /**
+         * Wait (up to timeout) for the messages queued so far to be written, e.g before abort().
+         */
+        static void flush(const std::chrono::milliseconds& timeout = std::chrono::seconds(1)) {
+          m_pushers.fetch_add(1);
+          ring* queue = m_ring.load();
+          if(queue) {
+            const std::size_t target = queue->pushed();
+            const auto deadline = std::chrono::steady_clock::now() + timeout;
+            while(queue->popped() < target && std::chrono::steady_clock::now() < deadline) {
+              wake_writer();
+              std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+          }
+          m_pushers.fetch_sub(1, std::memory_order_release);
         }
 
         /**
-         * shutdown the logger
+         * @return messages dropped on a full queue since start
+         */
+        static std::uint64_t get_dropped() noexcept { return m_dropped_total.load() + m_dropped.load(); }
+
+        /**
+         * shutdown the logger, writing the queued messages first
          */
         static void shutdown() {
+          stop_async();
+          writer& w = get_writer();
+          delete w.queue;
+          w.queue = nullptr;
           closelog();
         }
 
-    private:
+      /**
+       * @return name of a LOG_X priority, e.g "warning"
+       */
       static std::string priority_str(std::int32_t priority)
       {
         switch (priority) {
@@ -116,8 +608,679 @@ namespace daemonpp {
         }
       }
 
+    private:
+      /// Argument tags of the log_format() encoding: tag byte then the value
+      enum : char {
+        ARG_INT = 'i',       ///< i64
+        ARG_UINT = 'u',      ///< u64
+        ARG_DOUBLE = 'd',    ///< double
+        ARG_BOOL = 'b',      ///< u8
+        ARG_POINTER = 'p',   ///< u64
+        ARG_STRING = 's',    ///< u32 size then the bytes
+        ARG_TRUNCATED = 't'  ///< the next arguments did not fit in MAX_MESSAGE
+      };
+
+      /// log_format() arguments being encoded
+      struct encoder {
+        char data[MAX_MESSAGE];
+        std::size_t size{0};
+        bool truncated{false};  ///< an argument did not fit, the last byte is kept for the mark
+      };
+
+      static void encode(encoder& e) {
+        if(e.truncated) e.data[e.size++] = ARG_TRUNCATED;
+      }
+
+      template<typename Arg, typename... Args>
+      static void encode(encoder& e, const Arg& arg, const Args&... args) {
+        encode_arg(e, arg);
+        encode(e, args...);
+      }
+
+      static void put(encoder& e, char tag, const void* value, std::size_t length) noexcept {
+        if(e.truncated || e.size + 1 + length >= MAX_MESSAGE) {
+          e.truncated = true;
+          return;
+        }
+        e.data[e.size++] = tag;
+        std::memcpy(e.data + e.size, value, length);
+        e.size += length;
+      }
+
+      template<typename T>
+      static typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+      encode_arg(encoder& e, T value) noexcept {
+        const std::int64_t v = value;
+        put(e, ARG_INT, &v, sizeof(v));
+      }
+
+      template<typename T>
+      static typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type
+      encode_arg(encoder& e, T value) noexcept {
+        const std::uint64_t v = value;
+        put(e, ARG_UINT, &v, sizeof(v));
+      }
+
+      template<typename T>
+      static typename std::enable_if<std::is_floating_point<T>::value>::type
+      encode_arg(encoder& e, T value) noexcept {
+        const double v = static_cast<double>(value);
+        put(e, ARG_DOUBLE, &v, sizeof(v));
+      }
+
+      template<typename T>
+      static typename std::enable_if<std::is_enum<T>::value>::type
+      encode_arg(encoder& e, T value) noexcept {
+        encode_arg(e, static_cast<typename std::underlying_type<T>::type>(value));
+      }
+
+      template<typename T>
+      static typename std::enable_if<std::is_pointer<T>::value &&
+                                     !std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value>::type
+      encode_arg(encoder& e, T value) noexcept {
+        const std::uint64_t v = reinterpret_cast<std::uintptr_t>(value);
+        put(e, ARG_POINTER, &v, sizeof(v));
+      }
+
+      static void encode_arg(encoder& e, bool value) noexcept {
+        const std::uint8_t v = value ? 1 : 0;
+        put(e, ARG_BOOL, &v, sizeof(v));
+      }
+
+      static void encode_arg(encoder& e, const char* value) noexcept {
+        encode_string(e, value ? value : "(null)", value ? std::strlen(value) : 6);
+      }
+
+      static void encode_arg(encoder& e, const std::string& value) noexcept {
+        encode_string(e, value.data(), value.size());
+      }
+
+      /**
+       * Strings are cut to the room left rather than dropped.
+       */
+      static void encode_string(encoder& e, const char* value, std::size_t length) noexcept {
+        const std::size_t header = 1 + sizeof(std::uint32_t);
+        if(e.truncated || e.size + header + 1 >= MAX_MESSAGE) {
+          e.truncated = true;
+          return;
+        }
+        if(e.size + header + length >= MAX_MESSAGE) {
+          length = MAX_MESSAGE - e.size - header - 1;
+          e.truncated = true;
+        }
+        const std::uint32_t n = static_cast<std::uint32_t>(length);
+        e.data[e.size++] = ARG_STRING;
+        std::memcpy(e.data + e.size, &n, sizeof(n));
+        e.size += sizeof(n);
+        std::memcpy(e.data + e.size, value, length);
+        e.size += length;
+      }
+
+      /**
+       * Append the argument at offset to out.
+       * @return false on the truncation mark or malformed data
+       */
+      static bool decode_arg(const char* data, std::size_t size, std::size_t& offset, std::string& out) {
+        const char tag = data[offset++];
+        auto take = [&](void* value, std::size_t length) {
+          if(offset + length > size) return false;
+          std::memcpy(value, data + offset, length);
+          offset += length;
+          return true;
+        };
+        char text[32];
+        switch(tag) {
+          case ARG_INT: {
+            std::int64_t v;
+            if(!take(&v, sizeof(v))) return false;
+            out += std::to_string(v);
+            return true;
+          }
+          case ARG_UINT: {
+            std::uint64_t v;
+            if(!take(&v, sizeof(v))) return false;
+            out += std::to_string(v);
+            return true;
+          }
+          case ARG_DOUBLE: {
+            double v;
+            if(!take(&v, sizeof(v))) return false;
+            std::snprintf(text, sizeof(text), "%g", v);
+            out += text;
+            return true;
+          }
+          case ARG_BOOL: {
+            std::uint8_t v;
+            if(!take(&v, sizeof(v))) return false;
+            out += v ? "true" : "false";
+            return true;
+          }
+          case ARG_POINTER: {
+            std::uint64_t v;
+            if(!take(&v, sizeof(v))) return false;
+            std::snprintf(text, sizeof(text), "0x%llx", static_cast<unsigned long long>(v));
+            out += text;
+            return true;
+          }
+          case ARG_STRING: {
+            std::uint32_t n;
+            if(!take(&n, sizeof(n)) || offset + n > size) return false;
+            out.append(data + offset, n);
+            offset += n;
+            return true;
+          }
+          default:
+            return false;
+        }
+      }
+
+      static bool is_field_name(const std::string& name) noexcept {
+        if(name.empty() || name.size() > 64 || name[0] == '_' || (name[0] >= '0' && name[0] <= '9')) return false;
+        for(const char c : name)
+          if(!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) return false;
+        return true;
+      }
+
+      static std::size_t round_capacity(std::size_t capacity) noexcept {
+        std::size_t size = 2;
+        while(size < capacity) size <<= 1;
+        return size;
+      }
+
+    private:
+      /**
+       * Bounded multi producer, single consumer queue of fixed size records (Vyukov's sequence numbered slots):
+       * a producer claims a slot with a CAS on the tail and publishes it by bumping the slot's sequence.
+       */
+      class ring {
+        public:
+            struct record {
+              std::atomic<std::size_t> sequence;
+              std::int32_t priority;
+              std::uint32_t size;
+              const char* format;   ///< log_format()'s, text holds its encoded arguments, nullptr for a message
+              std::int64_t time_ns; ///< CLOCK_REALTIME, binary mode only
+              location where;
+              std::uint32_t fields_size;
+              char fields[MAX_FIELDS]; ///< the logging thread's set_field()s, journal mode only
+              char text[MAX_MESSAGE + 4];
+            };
+
+            /**
+             * @param timestamps: stamp the records when pushed (binary mode), syslog stamps them itself
+             * @param fields: copy the logging thread's fields into the records (journal mode)
+             */
+            ring(std::size_t capacity, bool timestamps, bool fields)
+              : m_records(new record[capacity]), m_mask(capacity - 1), m_timestamps(timestamps), m_with_fields(fields) {
+              for(std::size_t i = 0; i < capacity; i++)
+                m_records[i].sequence.store(i, std::memory_order_relaxed);
+            }
+
+            bool try_push(std::int32_t priority, const char* format, const location& where, const char* data, std::size_t size) noexcept {
+              std::size_t position = m_tail.load(std::memory_order_relaxed);
+              record* r;
+              for(;;) {
+                r = &m_records[position & m_mask];
+                const std::size_t sequence = r->sequence.load(std::memory_order_acquire);
+                if(sequence == position) {
+                  if(m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                } else if(sequence < position) {
+                  return false; // full
+                } else {
+                  position = m_tail.load(std::memory_order_relaxed);
+                }
+              }
+              r->priority = priority;
+              r->format = format;
+              r->where = where;
+              r->fields_size = 0;
+              if(m_with_fields) {
+                r->fields_size = static_cast<std::uint32_t>(m_fields.size());
+                std::memcpy(r->fields, m_fields.data(), m_fields.size());
+              }
+              if(m_timestamps)
+                r->time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+              if(size <= MAX_MESSAGE) {
+                r->size = static_cast<std::uint32_t>(size);
+                std::memcpy(r->text, data, size);
+              } else { // messages only, log_format() arguments fit
+                r->size = MAX_MESSAGE + 3;
+                std::memcpy(r->text, data, MAX_MESSAGE);
+                std::memcpy(r->text + MAX_MESSAGE, "...", 3);
+              }
+              r->text[r->size] = '\0';
+              // seq_cst: ordered before the writer idle check of log(), see write_queued().
+              r->sequence.store(position + 1);
+              return true;
+            }
+
+            /**
+             * Consumer side: pass the next record, if any, to consume.
+             */
+            template<typename F>
+            bool pop(F&& consume) {
+              if(!has_next()) return false;
+              record& r = m_records[m_head & m_mask];
+              consume(r);
+              r.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+              m_popped.store(++m_head, std::memory_order_release);
+              return true;
+            }
+
+            /// Consumer side: is the next record published
+            bool has_next() const noexcept { return m_records[m_head & m_mask].sequence.load() == m_head + 1; }
+
+            std::size_t capacity() const noexcept { return m_mask + 1; }
+            bool has_timestamps() const noexcept { return m_timestamps; }
+            bool has_fields() const noexcept { return m_with_fields; }
+            std::size_t pushed() const noexcept { return m_tail.load(std::memory_order_acquire); }
+            std::size_t popped() const noexcept { return m_popped.load(std::memory_order_acquire); }
+
+        private:
+            std::unique_ptr<record[]> m_records;
+            const std::size_t m_mask;
+            const bool m_timestamps;
+            const bool m_with_fields;
+            // Producers' tail and the consumer's head on their own cache lines (no alignas: new is not aligned in C++14).
+            char m_padding_tail[64];
+            std::atomic<std::size_t> m_tail{0};
+            char m_padding_head[64];
+            std::size_t m_head{0};
+            std::atomic<std::size_t> m_popped{0};
+      };
+
+      static void push(ring& queue, std::int32_t priority, const char* format, const location& where, const char* data, std::size_t size) {
+        while(!queue.try_push(priority, format, where, data, size)) {
+          if(m_overflow == overflow::drop) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+          }
+          wake_writer();
+          std::this_thread::yield();
+        }
+        // Only the first message after the writer went idle pays for waking it up.
+        if(m_writer_idle.load()) wake_writer();
+      }
+
+      /// Writer thread state, allocated once and never destroyed (see start_async())
+      struct writer {
+        std::thread* thread{nullptr};
+        ring* queue{nullptr};                               ///< the last queue, reused while its settings match
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        bool stopping{false};
+        int binary_fd{-1};                                  ///< binary mode output
+        std::string binary_path;
+        std::string buffer;                                 ///< binary entries of the batch, or a formatted message
+        std::unordered_map<const char*, std::uint32_t> ids; ///< binary mode format ids
+        int journal_fd{-1};                                 ///< journal mode output
+        std::string journal_path;
+        sockaddr_un journal_address{};
+        std::string identifier;                             ///< SYSLOG_IDENTIFIER
+        std::vector<std::string> datagrams;                 ///< journal mode batch, kept for their capacity
+        std::size_t batched{0};
+        dlogfile* file{nullptr};                            ///< file mode output
+        std::time_t stamp_second{-1};                       ///< file mode: second formatted in stamp
+        char stamp[64]{};
+        int pid{0};
+        std::function<void()> setup;                        ///< see set_writer_setup()
+      };
+
+      /// Datagrams per sendmmsg() of the journal mode
+      static constexpr std::size_t JOURNAL_BATCH = 64;
+
+      static writer& get_writer() {
+        static writer* w = []() {
+          // The writer thread does not survive fork(): the child logs synchronously.
+          pthread_atfork(nullptr, nullptr, []() {
+            m_ring.store(nullptr);
+            m_pushers.store(0); // the parent's other threads are not here
+            get_writer().thread = nullptr;
+            get_writer().queue = nullptr; // may hold a record the parent was pushing, never published
+            get_writer().binary_fd = -1; // the parent's
+            get_writer().journal_fd = -1;
+            get_writer().file = nullptr;
+          });
+          return new writer();
+        }();
+        return *w;
+      }
+
+      static void wake_writer() {
+        writer& w = get_writer();
+        {
+          std::lock_guard<std::mutex> lock(w.mutex);
+          m_writer_idle.store(false);
+        }
+        w.wakeup.notify_one();
+      }
+
+      static void start_writer(std::size_t capacity, overflow policy, int binary_fd, int journal_fd) {
+        writer& w = get_writer();
+        std::lock_guard<std::mutex> lock(w.mutex);
+        // stop_async() left the previous queue drained and unreferenced: reuse it, or free it when the settings changed.
+        // The current queue is never freed while in use, the writer may still run while exit() destroys statics.
+        const bool timestamps = binary_fd >= 0 || w.file;
+        const bool fields = journal_fd >= 0;
+        if(w.queue && (w.queue->capacity() != capacity || w.queue->has_timestamps() != timestamps || w.queue->has_fields() != fields)) {
+          delete w.queue;
+          w.queue = nullptr;
+        }
+        if(!w.queue) w.queue = new ring(capacity, timestamps, fields);
+        ring* queue = w.queue;
+        m_overflow = policy;
+        w.stopping = false;
+        w.binary_fd = binary_fd;
+        w.journal_fd = journal_fd;
+        w.batched = 0;
+        w.stamp_second = -1;
+        w.pid = static_cast<int>(getpid());
+        w.ids.clear();
+        w.buffer.clear();
+        if(binary_fd >= 0) {
+          w.buffer += 'H';
+          append(w.buffer, std::uint32_t{BINARY_VERSION});
+          append(w.buffer, static_cast<std::uint32_t>(w.pid));
+          append(w.buffer, now_ns());
+        }
+        m_writer_idle.store(false);
+        m_ring.store(queue, std::memory_order_release);
+        std::function<void()> setup = w.setup;
+        w.thread = new std::thread([queue, setup]() {
+          if(setup) setup();
+          write_queued(queue);
+        });
+      }
+
+      template<typename T>
+      static void append(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+      }
+
+      static std::int64_t now_ns() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+      }
+
+      /**
+       * Writer thread: send a record to syslog, or append it to the binary or journal batch.
+       */
+      static void write_record(writer& w, const ring::record& r) {
+        if(w.file) {
+          w.buffer.clear();
+          append_stamp(w, r.time_ns);
+          w.buffer += priority_str(r.priority);
+          w.buffer += ": ";
+          if(r.format) format_args(r.format, r.text, r.size, w.buffer);
+          else w.buffer.append(r.text, r.size);
+          w.buffer += '\n';
+          w.file->write(w.buffer);
+          return;
+        }
+        if(w.journal_fd >= 0) {
+          const char* message = r.text;
+          std::size_t size = r.size;
+          if(r.format) {
+            w.buffer.clear();
+            format_args(r.format, r.text, r.size, w.buffer);
+            message = w.buffer.data();
+            size = w.buffer.size();
+          }
+          if(w.batched == w.datagrams.size()) w.datagrams.emplace_back();
+          journal_entry(w, w.datagrams[w.batched++], r, message, size);
+          if(w.batched == JOURNAL_BATCH) flush_journal(w);
+          return;
+        }
+        if(w.binary_fd < 0) {
+          if(!r.format) {
+            syslog(r.priority, "%s", r.text);
+            return;
+          }
+          w.buffer.clear();
+          format_args(r.format, r.text, r.size, w.buffer);
+          syslog(r.priority, "%s", w.buffer.c_str());
+          return;
+        }
+        std::uint32_t id = 0;
+        if(r.format) {
+          auto it = w.ids.find(r.format);
+          if(it == w.ids.end()) {
+            it = w.ids.emplace(r.format, static_cast<std::uint32_t>(w.ids.size() + 1)).first;
+            w.buffer += 'F';
+            append(w.buffer, static_cast<std::uint32_t>(w.pid));
+            append(w.buffer, it->second);
+            append(w.buffer, static_cast<std::uint32_t>(std::strlen(r.format)));
+            w.buffer += r.format;
+          }
+          id = it->second;
+        }
+        w.buffer += 'R';
+        append(w.buffer, static_cast<std::uint32_t>(w.pid));
+        append(w.buffer, r.time_ns);
+        append(w.buffer, r.priority);
+        append(w.buffer, id);
+        append(w.buffer, r.size);
+        w.buffer.append(r.text, r.size);
+      }
+
+      /**
+       * Writer thread: "YYYY-mm-dd HH:MM:SS.uuuuuu [pid] " of the file mode, strftime() once per second.
+       */
+      static void append_stamp(writer& w, std::int64_t time_ns) {
+        const std::time_t seconds = static_cast<std::time_t>(time_ns / 1000000000);
+        if(seconds != w.stamp_second) {
+          std::tm local{};
+          localtime_r(&seconds, &local);
+          std::strftime(w.stamp, sizeof(w.stamp), "%Y-%m-%d %H:%M:%S", &local);
+          w.stamp_second = seconds;
+        }
+        char text[96];
+        const int n = std::snprintf(text, sizeof(text), "%s.%06d [%d] ", w.stamp, static_cast<int>(time_ns % 1000000000 / 1000), w.pid);
+        w.buffer.append(text, n > 0 ? static_cast<std::size_t>(n) : 0);
+      }
+
+      /**
+       * Writer thread: a record in journald's native protocol, one "NAME=value\n" per field, or
+       * "NAME\n", the value's u64 little endian size, the value and "\n" when the value has newlines.
+       */
+      static void journal_entry(const writer& w, std::string& out, const ring::record& r, const char* message, std::size_t size) {
+        out.clear();
+        journal_field(out, "MESSAGE", message, size);
+        out += "PRIORITY=";
+        out += std::to_string(r.priority);
+        out += "\nSYSLOG_FACILITY=";
+        out += std::to_string(LOG_DAEMON >> 3);
+        out += '\n';
+        journal_field(out, "SYSLOG_IDENTIFIER", w.identifier.data(), w.identifier.size());
+        if(r.where.file) {
+          journal_field(out, "CODE_FILE", r.where.file, std::strlen(r.where.file));
+          out += "CODE_LINE=";
+          out += std::to_string(r.where.line);
+          out += '\n';
+        }
+        out.append(r.fields, r.fields_size);
+      }
+
+      static void journal_field(std::string& out, const char* name, const char* value, std::size_t size) {
+        out += name;
+        if(!std::memchr(value, '\n', size)) {
+          out += '=';
+          out.append(value, size);
+          out += '\n';
+          return;
+        }
+        out += '\n';
+        for(int i = 0; i < 8; i++)
+          out += static_cast<char>(static_cast<std::uint64_t>(size) >> (8 * i));
+        out.append(value, size);
+        out += '\n';
+      }
+
+      /**
+       * Writer thread: send the journal batch, one sendmmsg() for all the records that fit in a datagram.
+       */
+      static void flush_journal(writer& w) {
+        mmsghdr messages[JOURNAL_BATCH];
+        iovec parts[JOURNAL_BATCH];
+        for(std::size_t i = 0; i < w.batched; i++) {
+          parts[i].iov_base = &w.datagrams[i][0];
+          parts[i].iov_len = w.datagrams[i].size();
+          messages[i] = mmsghdr{};
+          messages[i].msg_hdr.msg_name = &w.journal_address;
+          messages[i].msg_hdr.msg_namelen = sizeof(w.journal_address);
+          messages[i].msg_hdr.msg_iov = &parts[i];
+          messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        std::size_t sent = 0;
+        while(sent < w.batched) {
+          const int n = sendmmsg(w.journal_fd, messages + sent, static_cast<unsigned int>(w.batched - sent), MSG_NOSIGNAL);
+          if(n > 0) {
+            sent += static_cast<std::size_t>(n);
+          } else if(n < 0 && errno == EINTR) {
+            continue;
+          } else if(n < 0 && (errno == EMSGSIZE || errno == ENOBUFS)) {
+            send_memfd(w, w.datagrams[sent]); // too large for a datagram
+            sent++;
+          } else {
+            break; // journald is gone, nowhere to report it: the batch is lost
+          }
+        }
+        w.batched = 0;
+      }
+
+      /**
+       * Writer thread: pass a record too large for a datagram as a sealed memfd, the way sd_journal_send() does.
+       */
+      static bool send_memfd(const writer& w, const std::string& datagram) {
+        const int fd = memfd_create("dlog-journal", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if(fd < 0) return false;
+        bool sent = false;
+        if(write_all(fd, datagram.data(), datagram.size()) &&
+           fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0) {
+          union {
+            cmsghdr header;
+            char data[CMSG_SPACE(sizeof(int))];
+          } control{};
+          msghdr message{};
+          message.msg_name = const_cast<sockaddr_un*>(&w.journal_address);
+          message.msg_namelen = sizeof(w.journal_address);
+          message.msg_control = &control;
+          message.msg_controllen = sizeof(control);
+          cmsghdr* rights = CMSG_FIRSTHDR(&message);
+          rights->cmsg_level = SOL_SOCKET;
+          rights->cmsg_type = SCM_RIGHTS;
+          rights->cmsg_len = CMSG_LEN(sizeof(int));
+          std::memcpy(CMSG_DATA(rights), &fd, sizeof(int));
+          ssize_t n;
+          while((n = sendmsg(w.journal_fd, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+          sent = n >= 0;
+        }
+        ::close(fd);
+        return sent;
+      }
+
+      static bool write_all(int fd, const char* data, std::size_t size) {
+        std::size_t written = 0;
+        while(written < size) {
+          const ssize_t n = ::write(fd, data + written, size - written);
+          if(n < 0 && errno == EINTR) continue;
+          if(n <= 0) return false;
+          written += static_cast<std::size_t>(n);
+        }
+        return true;
+      }
+
+      /**
+       * Writer thread: write the binary batch.
+       */
+      static void flush_binary(writer& w) {
+        write_all(w.binary_fd, w.buffer.data(), w.buffer.size()); // nowhere to report a failure, the batch is lost
+        w.buffer.clear();
+      }
+
+      /**
+       * Writer thread: send what the batch of the binary or journal mode holds, end the file mode's group of writes.
+       */
+      static void flush_batch(writer& w) {
+        if(w.binary_fd >= 0) flush_binary(w);
+        if(w.journal_fd >= 0) flush_journal(w);
+        if(w.file) w.file->flush();
+      }
+
+      /**
+       * Writer thread: write a message of its own, in whichever mode.
+       */
+      static void write_notice(writer& w, const std::string& notice) {
+        ring::record r;
+        r.priority = LOG_WARNING;
+        r.format = nullptr;
+        r.time_ns = now_ns();
+        r.where = location{nullptr, 0};
+        r.fields_size = 0;
+        r.size = static_cast<std::uint32_t>(notice.size() < MAX_MESSAGE ? notice.size() : MAX_MESSAGE);
+        std::memcpy(r.text, notice.data(), r.size);
+        r.text[r.size] = '\0';
+        write_record(w, r);
+      }
+
+      /**
+       * Writer thread: log how many messages were dropped since the previous report, if any.
+       */
+      static void report_dropped(writer& w) {
+        const std::uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+        if(dropped == 0) return;
+        m_dropped_total.fetch_add(dropped, std::memory_order_relaxed);
+        write_notice(w, std::to_string(dropped) + " log messages dropped, the log queue was full.");
+      }
+
+      /**
+       * Writer thread: drain the queue, then sleep until a log call wakes it up.
+       */
+      static void write_queued(ring* queue) {
+        writer& w = get_writer();
+        auto consume = [&w](const ring::record& r) {
+          write_record(w, r);
+          if(w.binary_fd >= 0 && w.buffer.size() >= 65536) flush_binary(w);
+        };
+        std::unique_lock<std::mutex> lock(w.mutex);
+        for(;;) {
+          lock.unlock();
+          while(queue->pop(consume)) {}
+          report_dropped(w);
+          flush_batch(w);
+          lock.lock();
+          if(w.stopping) {
+            // Log calls that loaded the queue are done with it (see stop_async()): this drains the last records.
+            while(queue->pop(consume)) {}
+            report_dropped(w);
+            flush_batch(w);
+            return;
+          }
+          // Idle first, then look for the next record: its log call either sees the writer idle and wakes it,
+          // or the record is seen here (both seq_cst).
+          m_writer_idle.store(true);
+          if(queue->has_next()) continue;
+          w.wakeup.wait(lock, [&w]() { return !m_writer_idle.load() || w.stopping; });
+        }
+      }
+
     private:
         static std::string m_daemon_name;
+        static std::atomic<ring*> m_ring;
+        static std::atomic<std::int32_t> m_level;
+        static overflow m_overflow;
+        static std::atomic<bool> m_writer_idle;
+        static std::atomic<std::size_t> m_pushers; ///< log calls using the queue they loaded, see stop_async()
+        static std::atomic<std::uint64_t> m_dropped;
+        static std::atomic<std::uint64_t> m_dropped_total;
+        static thread_local std::string m_fields;  ///< set_field()s of the thread
     };
     std::string dlog::m_daemon_name{};
+    std::atomic<dlog::ring*> dlog::m_ring{nullptr};
+    std::atomic<std::int32_t> dlog::m_level{LOG_DEBUG};
+    dlog::overflow dlog::m_overflow{dlog::overflow::drop};
+    std::atomic<bool> dlog::m_writer_idle{false};
+    std::atomic<std::size_t> dlog::m_pushers{0};
+    std::atomic<std::uint64_t> dlog::m_dropped{0};
+    std::atomic<std::uint64_t> dlog::m_dropped_total{0};
+    thread_local std::string dlog::m_fields{};
 }
@@ -0,0 +1,448 @@
+#pragma once
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef DAEMONPP_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace daemonpp {
+  /**
+   * Rotating text file written through a memory mapping: the current segment is preallocated and mapped, so appending
+   * is a memcpy, no syscall. A segment is rotated once full or past its maximum age: trimmed to its content, renamed
+   * <path>.<YYYYmmdd-HHMMSS>, then gzipped by a background thread (with zlib, see DAEMONPP_HAVE_ZLIB in CMakeLists.txt)
+   * which also deletes the oldest rotated segments past keep.
+   * Used by dlog::start_file(), or directly for any other line oriented output. Not thread safe: one writer.
+   * The current segment is flock()ed: while another writer holds path (the old process of a hot upgrade), this one
+   * writes <path>.<pid> and moves back to path once released, see open_segment().
+   * @note: the current segment is padded with NUL bytes up to its size until rotated or closed (tail -f shows them).
+   * @note: reports its own failures to syslog directly, it sits below dlog.
+   */
+  class dlogfile {
+    public:
+        struct options {
+          std::size_t segment_size{64 * 1024 * 1024}; ///< bytes per segment, a line longer than that is cut
+          std::chrono::seconds max_age{0};            ///< rotate a segment that old even if not full, 0 to rotate on size only
+          std::size_t sync_bytes{0};                  ///< msync() at the next flush() once that many bytes are written, 0 leaves it to the kernel
+          std::size_t keep{10};                       ///< rotated segments kept
+          bool compress{true};                        ///< gzip the rotated segments, needs zlib
+
+          bool operator==(const options& other) const noexcept {
+            return segment_size == other.segment_size && max_age == other.max_age && sync_bytes == other.sync_bytes &&
+                   keep == other.keep && compress == other.compress;
+          }
+          bool operator!=(const options& other) const noexcept { return !(*this == other); }
+        };
+
+    public:
+        dlogfile() = default;
+        dlogfile(const dlogfile&) = delete;
+        dlogfile& operator=(const dlogfile&) = delete;
+        ~dlogfile() { close(); }
+
+        /**
+         * Open path as the current segment. A segment left by a previous run is rotated first, and the rotated
+         * segments it did not compress are queued for compression.
+         * @return false on failure (logged)
+         */
+        bool open(const std::string& path, const options& opts) {
+          close();
+          m_path = path;
+          if(!path.empty() && path[0] != '/') {
+            // The compressor and the rotations must not depend on later chdir()s.
+            char cwd[4096];
+            if(getcwd(cwd, sizeof(cwd))) m_path = std::string(cwd) + "/" + path;
+          }
+          m_options = opts;
+          const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+          m_size = (std::max(m_options.segment_size, page) + page - 1) / page * page;
+          m_stopping = false;
+          for(const std::string& segment : list_rotated())
+            if(!ends_with(segment, ".gz")) m_pending.push_back(segment);
+          m_thread = std::thread([this]() { compress_queued(); });
+          return open_segment();
+        }
+
+        /**
+         * Trim the current segment to its content, keeping it at path, and stop the compressor once done with its
+         * current segment, the others are compressed at the next open().
+         * A <path>.<pid> segment is rotated instead: no later open() would pick it up.
+         */
+        void close() {
+          close_segment(m_live != m_path);
+          m_live.clear();
+          if(m_thread.joinable()) {
+            {
+              std::lock_guard<std::mutex> lock(m_mutex);
+              m_stopping = true;
+            }
+            m_wakeup.notify_one();
+            m_thread.join();
+            m_pending.clear();
+          }
+        }
+
+        bool is_open() const noexcept { return m_map != nullptr; }
+        const std::string& get_path() const noexcept { return m_path; }
+        /// Segment written: path, or <path>.<pid> while another writer holds path
+        const std::string& get_live_path() const noexcept { return m_live; }
+        const options& get_options() const noexcept { return m_options; }
+
+        /**
+         * Append data, rotating first if the current segment has no room left for it.
+         * @return false if not open or the next segment could not be opened
+         */
+        bool write(const char* data, std::size_t size) {
+          if(!m_map) return false;
+          if(m_offset + size > m_size && m_offset > 0 && !rotate()) return false;
+          if(size > m_size - m_offset) size = m_size - m_offset;
+          std::memcpy(m_map + m_offset, data, size);
+          m_offset += size;
+          return true;
+        }
+
+        bool write(const std::string& data) { return write(data.data(), data.size()); }
+
+        /**
+         * End of a group of writes: msync() once sync_bytes are written since the last one, and rotate a segment past
+         * max_age, or a <path>.<pid> segment once path is released. Call it once per batch rather than per line.
+         */
+        void flush() {
+          if(!m_map) return;
+          if(m_options.sync_bytes > 0 && m_offset - m_synced >= m_options.sync_bytes) sync();
+          const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          if(m_options.max_age.count() > 0 && m_offset > 0 && now - m_opened >= m_options.max_age) {
+            rotate();
+          } else if(m_live != m_path && now - m_checked >= std::chrono::seconds(1)) {
+            m_checked = now;
+            if(is_released(m_path)) rotate();
+          }
+        }
+
+        /**
+         * Write the current segment's new content to disk.
+         */
+        void sync() {
+          if(!m_map || m_offset == m_synced) return;
+          const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+          const std::size_t from = m_synced / page * page;
+          if(msync(m_map + from, m_offset - from, MS_SYNC) < 0)
+            syslog(LOG_ERR, "Could not sync log file %s: %s", m_path.c_str(), std::strerror(errno));
+          m_synced = m_offset;
+        }
+
+        /**
+         * Start a new segment now.
+         * @return false if the new one could not be opened (logged)
+         */
+        bool rotate() {
+          close_segment(true);
+          return open_segment();
+        }
+
+    private:
+        static constexpr int MAX_FALLBACKS = 16; // <path>.<pid>[.n] segments tried, for dlogfiles of this process on path
+        static constexpr int LOCKED = -2;        // lock_segment(): held by another writer
+
+        /**
+         * Lock and map the next segment: path, or <path>.<pid>[.n] while another writer holds path's lock. Writers
+         * never truncate, rename or unmap each other's segment, so a second writer (the new process of a hot upgrade,
+         * overlapping with the old one) must not take it over until released: flush() checks for it.
+         */
+        bool open_segment() {
+          const std::string own = m_path + "." + std::to_string(getpid());
+          for(int n = -1; n < MAX_FALLBACKS; n++) {
+            const std::string live = n < 0 ? m_path : n == 0 ? own : own + "." + std::to_string(n);
+            const int fd = lock_segment(live);
+            if(fd == LOCKED) continue;
+            if(fd < 0) return false;
+            // Allocated blocks, not a sparse file: a full disk fails here rather than with SIGBUS on a store.
+            const int error = posix_fallocate(fd, 0, static_cast<off_t>(m_size));
+            void* map = error == 0 ? mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            if(map == MAP_FAILED) {
+              syslog(LOG_ERR, "Could not map log file %s: %s", live.c_str(), std::strerror(error ? error : errno));
+              ::unlink(live.c_str());
+              ::close(fd);
+              return false;
+            }
+            if(n >= 0 && m_live != live)
+              syslog(LOG_NOTICE, "Log file %s is written by another process, writing %s meanwhile.", m_path.c_str(), live.c_str());
+            m_fd = fd;
+            m_live = live;
+            m_map = static_cast<char*>(map);
+            m_offset = 0;
+            m_synced = 0;
+            m_opened = std::chrono::steady_clock::now();
+            m_checked = m_opened;
+            return true;
+          }
+          syslog(LOG_ERR, "Could not open log file %s: every fallback segment is in use.", m_path.c_str());
+          return false;
+        }
+
+        /**
+         * Open and flock() live, an empty file. Content found there, left by a crash or a writer which closed, is
+         * trimmed and rotated first.
+         * @return the locked fd, LOCKED if another writer holds it, -1 on failure (logged)
+         */
+        int lock_segment(const std::string& live) {
+          for(;;) {
+            const int fd = ::open(live.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+            if(fd < 0) {
+              syslog(LOG_ERR, "Could not open log file %s: %s", live.c_str(), std::strerror(errno));
+              return -1;
+            }
+            if(flock(fd, LOCK_EX | LOCK_NB) < 0) {
+              const int error = errno;
+              ::close(fd);
+              if(error == EWOULDBLOCK) return LOCKED;
+              syslog(LOG_ERR, "Could not lock log file %s: %s", live.c_str(), std::strerror(error));
+              return -1;
+            }
+            // Rotated by its writer between open() and flock(): lock the file now at live instead.
+            struct stat opened{}, current{};
+            if(fstat(fd, &opened) < 0 || ::stat(live.c_str(), &current) < 0 ||
+               opened.st_dev != current.st_dev || opened.st_ino != current.st_ino) {
+              ::close(fd);
+              continue;
+            }
+            // A crash leaves the preallocated tail, keep the content only.
+            const off_t content = content_size(fd, opened.st_size);
+            if(ftruncate(fd, content) < 0) {
+              syslog(LOG_ERR, "Could not trim log file %s: %s", live.c_str(), std::strerror(errno));
+              ::close(fd);
+              return -1;
+            }
+            if(content == 0) return fd;
+            const std::string rotated = archive(live);
+            ::close(fd);
+            queue(rotated);
+            if(rotated.empty()) return -1;
+          }
+        }
+
+        /**
+         * Trim the current segment to its content and release it, rotated (or deleted if empty) when `rotated`.
+         */
+        void close_segment(bool rotated) {
+          if(!m_map) return;
+          if(m_options.sync_bytes > 0) sync();
+          munmap(m_map, m_size);
+          m_map = nullptr;
+          if(ftruncate(m_fd, static_cast<off_t>(m_offset)) < 0)
+            syslog(LOG_ERR, "Could not trim log file %s: %s", m_live.c_str(), std::strerror(errno));
+          // Renamed while still locked: another writer never takes a segment about to be rotated.
+          std::string segment;
+          if(rotated && m_offset > 0) segment = archive(m_live);
+          else if(rotated) ::unlink(m_live.c_str());
+          ::close(m_fd);
+          m_fd = -1;
+          queue(segment);
+        }
+
+        /**
+         * Rename a segment to its rotated name, <path>.<YYYYmmdd-HHMMSS>[-n], whichever segment it was written as.
+         * @return the rotated name, empty on failure (logged)
+         */
+        std::string archive(const std::string& segment) {
+          char stamp[32];
+          const std::time_t now = std::time(nullptr);
+          std::tm local{};
+          localtime_r(&now, &local);
+          std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+          // link() fails on an existing name where rename() would replace it: no race with another writer's rotation.
+          std::string rotated = m_path + "." + stamp;
+          for(int i = 1; ; i++) {
+            if(!exists(rotated + ".gz")) {
+              if(::link(segment.c_str(), rotated.c_str()) == 0) break;
+              if(errno != EEXIST) {
+                syslog(LOG_ERR, "Could not rotate log file %s: %s", segment.c_str(), std::strerror(errno));
+                return std::string();
+              }
+            }
+            rotated = m_path + "." + stamp + "-" + std::to_string(i);
+          }
+          ::unlink(segment.c_str());
+          return rotated;
+        }
+
+        /**
+         * Hand a rotated segment to the compressor, once released: it skips segments still locked.
+         */
+        void queue(const std::string& segment) {
+          if(segment.empty()) return;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.push_back(segment);
+          }
+          m_wakeup.notify_one();
+        }
+
+        /**
+         * @return true if no writer holds the segment at path
+         */
+        static bool is_released(const std::string& path) {
+          const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+          if(fd < 0) return errno == ENOENT;
+          const bool released = flock(fd, LOCK_SH | LOCK_NB) == 0;
+          ::close(fd);
+          return released;
+        }
+
+        /**
+         * Compressor thread: gzip the rotated segments, then delete the oldest past keep.
+         */
+        void compress_queued() {
+          // Only spare cycles: the daemon's threads always run first.
+          sched_param param{};
+          pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+          std::unique_lock<std::mutex> lock(m_mutex);
+          for(;;) {
+            m_wakeup.wait(lock, [this]() { return m_stopping || !m_pending.empty(); });
+            if(m_stopping) return;
+            const std::string segment = m_pending.front();
+            m_pending.pop_front();
+            lock.unlock();
+            if(m_options.compress) compress(segment);
+            prune();
+            lock.lock();
+          }
+        }
+
+#ifdef DAEMONPP_HAVE_ZLIB
+        static void compress(const std::string& segment) {
+          const int in = ::open(segment.c_str(), O_RDONLY | O_CLOEXEC);
+          if(in < 0) return; // pruned meanwhile
+          // Still written, or compressed by another process' compressor.
+          if(flock(in, LOCK_EX | LOCK_NB) < 0) {
+            ::close(in);
+            return;
+          }
+          const std::string temporary = segment + ".gz.tmp";
+          const int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+          gzFile out = fd >= 0 ? gzdopen(fd, "wb") : nullptr;
+          if(fd >= 0 && !out) ::close(fd);
+          bool ok = out != nullptr;
+          char buffer[65536];
+          ssize_t n;
+          while(ok && (n = ::read(in, buffer, sizeof(buffer))) != 0) {
+            if(n < 0 && errno == EINTR) continue;
+            ok = n > 0 && gzwrite(out, buffer, static_cast<unsigned>(n)) == n;
+          }
+          if(out && gzclose(out) != Z_OK) ok = false;
+          if(ok && ::rename(temporary.c_str(), (segment + ".gz").c_str()) == 0) {
+            ::unlink(segment.c_str());
+            ::close(in);
+            return;
+          }
+          syslog(LOG_ERR, "Could not compress log segment %s.", segment.c_str());
+          ::unlink(temporary.c_str());
+          ::close(in);
+        }
+#else
+        static void compress(const std::string&) {} // without zlib, rotated segments stay as they are
+#endif
+
+        void prune() {
+          std::vector<std::string> rotated = list_rotated();
+          for(std::size_t i = 0; i + m_options.keep < rotated.size(); i++)
+            if(is_released(rotated[i])) ::unlink(rotated[i].c_str());
+        }
+
+        /**
+         * Rotated segments, oldest first.
+         */
+        std::vector<std::string> list_rotated() const {
+          std::vector<std::string> rotated;
+          const std::size_t slash = m_path.rfind('/');
+          const std::string directory = m_path.substr(0, slash == 0 ? 1 : slash);
+          const std::string prefix = m_path.substr(slash + 1) + ".";
+          DIR* dir = opendir(directory.c_str());
+          if(!dir) return rotated;
+          while(dirent* entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            if(name.compare(0, prefix.size(), prefix) == 0 && is_stamp(strip_gz(name).substr(prefix.size())))
+              rotated.push_back(directory + "/" + name);
+          }
+          closedir(dir);
+          std::sort(rotated.begin(), rotated.end(), [](const std::string& a, const std::string& b) { return strip_gz(a) < strip_gz(b); });
+          return rotated;
+        }
+
+        /**
+         * Size of the content of a segment not trimmed, without its NUL padding.
+         */
+        static off_t content_size(int fd, off_t size) {
+          char buffer[65536];
+          while(size > 0) {
+            const off_t from = size > static_cast<off_t>(sizeof(buffer)) ? size - static_cast<off_t>(sizeof(buffer)) : 0;
+            const ssize_t n = pread(fd, buffer, static_cast<std::size_t>(size - from), from);
+            if(n <= 0) return size;
+            for(ssize_t i = n; i > 0; i--)
+              if(buffer[i - 1] != '\0') return from + i;
+            size = from;
+          }
+          return 0;
+        }
+
+        /**
+         * YYYYmmdd-HHMMSS[-n], not the <pid>[.n] of a segment written while another writer held path.
+         */
+        static bool is_stamp(const std::string& suffix) {
+          if(suffix.size() < 15 || (suffix.size() > 15 && (suffix[15] != '-' || suffix.size() == 16))) return false;
+          for(std::size_t i = 0; i < suffix.size(); i++)
+            if(i != 8 && i != 15 && !std::isdigit(static_cast<unsigned char>(suffix[i]))) return false;
+          return suffix[8] == '-';
+        }
+
+        static bool exists(const std::string& path) {
+          struct stat st{};
+          return ::stat(path.c_str(), &st) == 0;
+        }
+
+        static bool ends_with(const std::string& text, const std::string& suffix) {
+          return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+
+        static std::string strip_gz(const std::string& name) {
+          return ends_with(name, ".gz") ? name.substr(0, name.size() - 3) : name;
+        }
+
+    private:
+        std::string m_path;
+        std::string m_live;       // current segment: m_path, or a fallback while another writer holds it
+        options m_options;
+        std::size_t m_size{0};    // mapped segment size
+        int m_fd{-1};
+        char* m_map{nullptr};
+        std::size_t m_offset{0};  // end of the content
+        std::size_t m_synced{0};  // end of the content msync()ed
+        std::chrono::steady_clock::time_point m_opened{};
+        std::chrono::steady_clock::time_point m_checked{}; // last check whether m_path was released
+        // Compressor
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        std::deque<std::string> m_pending;
+        bool m_stopping{false};
+  };
+} // !namespace daemonpp
@@ -0,0 +1,770 @@
+#pragma once
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include "dlog.hpp"
+#include "during.hpp"
+
+namespace daemonpp {
+  /**
+   * Single threaded event loop (reactor) owned by the daemon.
+   * Multiplexes file descriptors, timers (timerfd) and cross thread wake ups (eventfd)
+   * with one epoll instance, so a daemon does not need extra polling threads.
+   * @note: all methods except post() and wakeup() must be called from the loop's thread.
+   */
+  class dloop {
+    public:
+        /// Called with the ready epoll events mask (EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP...)
+        using fd_callback = std::function<void(std::uint32_t events)>;
+        using timer_callback = std::function<void()>;
+        using task = std::function<void()>;
+        using clock = std::chrono::steady_clock;
+
+    public:
+        dloop() {
+          m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+          if(m_epoll_fd < 0) {
+            dlog::error("Could not create epoll instance: " + std::string(std::strerror(errno)));
+            return;
+          }
+          m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          if(m_wakeup_fd < 0) {
+            dlog::error("Could not create wakeup eventfd: " + std::string(std::strerror(errno)));
+            return;
+          }
+          add_fd(m_wakeup_fd, EPOLLIN, [this](std::uint32_t) {
+            std::uint64_t count;
+            while(::read(m_wakeup_fd, &count, sizeof(count)) > 0) {}
+            run_posted();
+          });
+        }
+
+        dloop(const dloop&) = delete;
+        dloop& operator=(const dloop&) = delete;
+
+        ~dloop() {
+          for(auto& entry : m_handlers)
+            if(entry.second->owned) ::close(entry.first);
+          if(m_wakeup_fd >= 0) ::close(m_wakeup_fd);
+          if(m_epoll_fd >= 0) ::close(m_epoll_fd);
+        }
+
+        /**
+         * Watch a file descriptor. Pending async operations on it (see async_read()) don't prevent it.
+         * @param fd: file descriptor to watch, preferably non blocking
+         * @param events: epoll events mask to watch, e.g EPOLLIN | EPOLLOUT
+         * @param callback: called on the loop's thread when fd is ready
+         * @return false on failure (logged)
+         */
+        bool add_fd(int fd, std::uint32_t events, fd_callback callback) {
+          auto it = m_handlers.find(fd);
+          if(it == m_handlers.end() || it->second->callback)
+            return add_handler(fd, events, std::move(callback), false);
+          // Only registered for the epoll fallback's async operations: a new generation drops events already read.
+          handler& h = *it->second;
+          h.callback = std::move(callback);
+          h.user_events = events;
+          h.generation = ++m_generation;
+          return update_events(fd, h, true);
+        }
+
+        /**
+         * Change the events mask of a watched file descriptor.
+         */
+        bool modify_fd(int fd, std::uint32_t events) {
+          auto it = m_handlers.find(fd);
+          if(it == m_handlers.end() || !it->second->callback) return false;
+          it->second->user_events = events;
+          return update_events(fd, *it->second, false);
+        }
+
+        /**
+         * Stop watching a file descriptor. Does not close it, its pending async operations keep waiting.
+         * Safe to call from inside the fd's own callback.
+         */
+        void remove_fd(int fd) {
+          auto it = m_handlers.find(fd);
+          if(it == m_handlers.end()) return;
+          if(it->second->readers.empty() && it->second->writers.empty()) {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            m_handlers.erase(it);
+            return;
+          }
+          // A new handler keeps the waiters: the current one may be running its callback.
+          std::shared_ptr<handler> waiting = std::make_shared<handler>();
+          waiting->events = it->second->events;
+          waiting->generation = it->second->generation;
+          waiting->readers = std::move(it->second->readers);
+          waiting->writers = std::move(it->second->writers);
+          it->second = waiting;
+          update_events(fd, *waiting, false);
+        }
+
+        /**
+         * Add a timer backed by a timerfd.
+         * @param initial: delay before the first expiration, zero disarms the timer
+         * @param interval: period of the following expirations, zero for a one shot timer
+         * @param callback: called on the loop's thread when the timer expires
+         * @return timer id to be used with set_timer()/remove_timer(), -1 on failure (logged)
+         */
+        template<typename Rep1, typename Period1, typename Rep2 = std::int64_t, typename Period2 = std::nano>
+        int add_timer(const std::chrono::duration<Rep1, Period1>& initial, timer_callback callback,
+                      const std::chrono::duration<Rep2, Period2>& interval = std::chrono::duration<Rep2, Period2>::zero()) {
+          const int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+          if(tfd < 0) {
+            dlog::error("Could not create timerfd: " + std::string(std::strerror(errno)));
+            return -1;
+          }
+          const bool added = add_handler(tfd, EPOLLIN, [tfd, callback](std::uint32_t) {
+            std::uint64_t expirations;
+            if(::read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+              callback();
+          }, true);
+          if(!added) {
+            ::close(tfd);
+            return -1;
+          }
+          set_timer(tfd, initial, interval);
+          return tfd;
+        }
+
+        /**
+         * Re-arm a timer relative to now.
+         */
+        template<typename Rep1, typename Period1, typename Rep2 = std::int64_t, typename Period2 = std::nano>
+        bool set_timer(int timer_id, const std::chrono::duration<Rep1, Period1>& initial,
+                       const std::chrono::duration<Rep2, Period2>& interval = std::chrono::duration<Rep2, Period2>::zero()) {
+          itimerspec spec{};
+          spec.it_value = to_timespec(initial);
+          spec.it_interval = to_timespec(interval);
+          // A zero it_value disarms a timerfd, make sure an already due timer still fires.
+          if(initial <= std::chrono::duration<Rep1, Period1>::zero() && interval > std::chrono::duration<Rep2, Period2>::zero())
+            spec.it_value.tv_nsec = 1;
+          return arm(timer_id, spec, 0);
+        }
+
+        /**
+         * Re-arm a one shot timer to expire at an absolute point of the monotonic clock.
+         * A deadline in the past expires immediately.
+         */
+        bool set_timer_at(int timer_id, const clock::time_point& deadline) {
+          itimerspec spec{};
+          spec.it_value = to_timespec(deadline.time_since_epoch());
+          if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1;
+          return arm(timer_id, spec, TFD_TIMER_ABSTIME);
+        }
+
+        /**
+         * Disarm a timer without removing it.
+         */
+        bool cancel_timer(int timer_id) {
+          itimerspec spec{};
+          return arm(timer_id, spec, 0);
+        }
+
+        /**
+         * Remove and close a timer.
+         */
+        void remove_timer(int timer_id) {
+          auto it = m_handlers.find(timer_id);
+          if(it == m_handlers.end() || !it->second->owned) return;
+          remove_fd(timer_id);
+          ::close(timer_id);
+        }
+
+        /**
+         * Queue a task to run on the loop's thread and wake the loop up.
+         * @note: thread safe.
+         */
+        void post(task t) {
+          {
+            std::lock_guard<std::mutex> lock(m_posted_mutex);
+            m_posted.push_back(std::move(t));
+          }
+          wakeup();
+        }
+
+        /**
+         * Wake the loop up from epoll_wait().
+         * @note: thread safe and async signal safe.
+         */
+        void wakeup() noexcept {
+          const std::uint64_t one = 1;
+          const ssize_t r = ::write(m_wakeup_fd, &one, sizeof(one));
+          (void) r; // EAGAIN means the counter is already non zero, the loop will wake up anyway
+        }
+
+        /**
+         * Wait for events and dispatch them once.
+         * @param timeout_ms: maximum time to wait in milliseconds, -1 waits until an event arrives
+         * @return number of dispatched events
+         */
+        int run_once(int timeout_ms = -1) {
+          // Completions of the epoll fallback are pending, don't block.
+          if(!m_deferred.empty()) timeout_ms = 0;
+#if DAEMONPP_HAVE_IO_URING
+          const int n = m_ring ? run_ring_once(timeout_ms) : dispatch_epoll(timeout_ms);
+#else
+          const int n = dispatch_epoll(timeout_ms);
+#endif
+          run_deferred();
+          return n;
+        }
+
+        /**
+         * Run the loop until stop() is called.
+         */
+        void run() {
+          m_stopped = false;
+          while(!m_stopped) run_once(-1);
+        }
+
+        /**
+         * Make run() return after the current iteration.
+         */
+        void stop() {
+          m_stopped = true;
+          wakeup();
+        }
+
+        int get_epoll_fd() const noexcept { return m_epoll_fd; }
+
+        /**
+         * Detach a forked child's loop from its parent's: a forked epoll instance, eventfd and timerfds are shared
+         * with the parent, so the child gets fresh ones under the same fd numbers (timer ids stay valid, timers keep
+         * their remaining time) and every watched fd is registered again. The io_uring backend is dropped,
+         * call use_io_uring() again if needed.
+         * @note: call it in the child, right after fork().
+         * @return false on failure (logged)
+         */
+        bool after_fork() {
+#if DAEMONPP_HAVE_IO_URING
+          m_ring.reset();
+          m_epoll_polled = false;
+#endif
+          if(!renew(m_epoll_fd, epoll_create1(EPOLL_CLOEXEC))) return false;
+          if(!renew(m_wakeup_fd, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) return false;
+          bool ok = true;
+          for(auto& entry : m_handlers) {
+            if(entry.second->owned) {
+              itimerspec spec{};
+              timerfd_gettime(entry.first, &spec);
+              if(!renew(entry.first, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))) {
+                ok = false;
+                continue;
+              }
+              timerfd_settime(entry.first, 0, &spec, nullptr);
+            }
+            epoll_event ev{};
+            ev.events = entry.second->events;
+            ev.data.u64 = key(entry.first, entry.second->generation);
+            if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, entry.first, &ev) < 0) {
+              dlog::error("Could not watch fd " + std::to_string(entry.first) + ": " + std::string(std::strerror(errno)));
+              ok = false;
+            }
+          }
+          return ok;
+        }
+
+    public: // asynchronous IO
+        /// Called with the operation result: >= 0 on success (bytes, accepted fd...), -errno on failure
+        using io_callback = std::function<void(std::int32_t result)>;
+
+        enum class backend {
+          epoll,   ///< readiness based: async operations wait for readiness then run the syscall
+          io_uring ///< completion based: operations are queued and submitted in batch with the wait, one syscall per loop iteration
+        };
+
+        /**
+         * Switch to the io_uring backend (Linux 5.11+), fds/timers/wake ups keep working through the epoll fd
+         * which is itself polled by the ring.
+         * @note: call it from the loop's thread, after the daemon forked (the daemon does it in run(), see daemon::set_loop_backend()).
+         * @param entries: submission queue size
+         * @return false when io_uring is not supported (or not compiled in, see DAEMONPP_HAVE_IO_URING in during.hpp),
+         * the loop then keeps using epoll
+         */
+        bool use_io_uring(unsigned entries = 256) {
+#if !DAEMONPP_HAVE_IO_URING
+          (void) entries;
+          dlog::notice("io_uring support is not compiled in, using the epoll event loop backend.");
+          return false;
+#else
+          if(m_ring) return true;
+          std::unique_ptr<during> ring(new during(entries));
+          if(!ring->is_ok()) {
+            dlog::notice("Falling back to the epoll event loop backend.");
+            return false;
+          }
+          if(!m_buffers.empty() && !ring->register_buffers(m_buffers.data(), static_cast<unsigned>(m_buffers.size())))
+            return false;
+          m_ring = std::move(ring);
+          return true;
+#endif
+        }
+
+#if DAEMONPP_HAVE_IO_URING
+        backend get_backend() const noexcept { return m_ring ? backend::io_uring : backend::epoll; }
+#else
+        backend get_backend() const noexcept { return backend::epoll; }
+#endif
+
+        /**
+         * Register fixed buffers for async_read_fixed()/async_write_fixed().
+         * With io_uring the pages are pinned once instead of being mapped on every operation.
+         * @note: buffers must outlive the loop (or the next register_buffers() call).
+         */
+        bool register_buffers(const std::vector<iovec>& buffers) {
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring && !m_buffers.empty()) m_ring->unregister_buffers();
+          m_buffers = buffers;
+          return !m_ring || m_buffers.empty() || m_ring->register_buffers(m_buffers.data(), static_cast<unsigned>(m_buffers.size()));
+#else
+          m_buffers = buffers;
+          return true;
+#endif
+        }
+
+        /**
+         * Read up to len bytes into buf.
+         * With the epoll backend, operations waiting for readiness share the fd's registration with add_fd(): reads
+         * and writes in flight on the same fd complete in their submission order, each direction on its own.
+         * @note: with both backends, close fd only once its operations completed.
+         * @param offset: file offset, -1 to read at the current position (sockets, pipes)
+         */
+        void async_read(int fd, void* buf, std::size_t len, std::int64_t offset, io_callback callback) {
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op(std::move(callback));
+            sqe->opcode = IORING_OP_READ;
+            prep_rw(sqe, fd, buf, len, offset);
+            return;
+          }
+#endif
+          emulate(fd, EPOLLIN, [fd, buf, len, offset]() {
+            return offset < 0 ? ::read(fd, buf, len) : ::pread(fd, buf, len, static_cast<off_t>(offset));
+          }, std::move(callback));
+        }
+
+        /**
+         * Write up to len bytes from buf.
+         * @param offset: file offset, -1 to write at the current position (sockets, pipes, O_APPEND files)
+         */
+        void async_write(int fd, const void* buf, std::size_t len, std::int64_t offset, io_callback callback) {
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op(std::move(callback));
+            sqe->opcode = IORING_OP_WRITE;
+            prep_rw(sqe, fd, buf, len, offset);
+            return;
+          }
+#endif
+          emulate(fd, EPOLLOUT, [fd, buf, len, offset]() {
+            return offset < 0 ? ::write(fd, buf, len) : ::pwrite(fd, buf, len, static_cast<off_t>(offset));
+          }, std::move(callback));
+        }
+
+        /**
+         * Read into the registered buffer buffer_index (see register_buffers()).
+         */
+        void async_read_fixed(int fd, std::uint32_t buffer_index, std::size_t len, std::int64_t offset, io_callback callback) {
+          if(buffer_index >= m_buffers.size() || len > m_buffers[buffer_index].iov_len) {
+            defer_result(std::move(callback), -EINVAL);
+            return;
+          }
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op(std::move(callback));
+            sqe->opcode = IORING_OP_READ_FIXED;
+            prep_rw(sqe, fd, m_buffers[buffer_index].iov_base, len, offset);
+            sqe->buf_index = static_cast<std::uint16_t>(buffer_index);
+            return;
+          }
+#endif
+          async_read(fd, m_buffers[buffer_index].iov_base, len, offset, std::move(callback));
+        }
+
+        /**
+         * Write from the registered buffer buffer_index (see register_buffers()).
+         */
+        void async_write_fixed(int fd, std::uint32_t buffer_index, std::size_t len, std::int64_t offset, io_callback callback) {
+          if(buffer_index >= m_buffers.size() || len > m_buffers[buffer_index].iov_len) {
+            defer_result(std::move(callback), -EINVAL);
+            return;
+          }
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op(std::move(callback));
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            prep_rw(sqe, fd, m_buffers[buffer_index].iov_base, len, offset);
+            sqe->buf_index = static_cast<std::uint16_t>(buffer_index);
+            return;
+          }
+#endif
+          async_write(fd, m_buffers[buffer_index].iov_base, len, offset, std::move(callback));
+        }
+
+        /**
+         * Accept a connection on a listening socket, the result is the new (non blocking, close on exec) fd.
+         */
+        void async_accept(int fd, io_callback callback) {
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op(std::move(callback));
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = fd;
+            sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            return;
+          }
+#endif
+          emulate(fd, EPOLLIN, [fd]() {
+            return static_cast<ssize_t>(::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+          }, std::move(callback));
+        }
+
+        /**
+         * Flush a file to disk.
+         * @note: with the epoll backend fsync runs synchronously on the loop's thread.
+         * @param datasync: only flush data (fdatasync)
+         */
+        void async_fsync(int fd, bool datasync, io_callback callback) {
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op(std::move(callback));
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = fd;
+            sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+            return;
+          }
+#endif
+          const int r = datasync ? ::fdatasync(fd) : ::fsync(fd);
+          defer_result(std::move(callback), r < 0 ? -errno : 0);
+        }
+
+        /**
+         * Call callback once after delay (IORING_OP_TIMEOUT with io_uring, a one shot timerfd with epoll).
+         */
+        template<typename Rep, typename Period>
+        void async_timeout(const std::chrono::duration<Rep, Period>& delay, timer_callback callback) {
+#if DAEMONPP_HAVE_IO_URING
+          if(m_ring) {
+            io_uring_sqe* sqe = queue_op([callback](std::int32_t) { callback(); });
+            io_op* op = reinterpret_cast<io_op*>(sqe->user_data);
+            const auto ns = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count(), std::chrono::nanoseconds::rep(0));
+            op->timeout.tv_sec = ns / 1000000000;
+            op->timeout.tv_nsec = ns % 1000000000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<std::uint64_t>(&op->timeout); // read at submission, lives in the op until completion
+            sqe->len = 1;
+            return;
+          }
+#endif
+          // A zero it_value disarms a timerfd: an immediate timeout still waits 1ns, like set_timer_at().
+          const std::chrono::nanoseconds wait = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(delay), std::chrono::nanoseconds(1));
+          std::shared_ptr<int> timer_id = std::make_shared<int>(-1);
+          *timer_id = add_timer(wait, [this, timer_id, callback]() {
+            remove_timer(*timer_id);
+            callback();
+          });
+        }
+
+    private:
+#if DAEMONPP_HAVE_IO_URING
+        /// In flight io_uring operation, its address is the SQE user_data
+        struct io_op {
+          io_callback callback;
+          __kernel_timespec timeout{};
+        };
+        /// user_data of the epoll fd poll request (io_op addresses are aligned, never odd)
+        static constexpr std::uint64_t EPOLL_POLL_TAG = 1;
+#endif
+
+        /// Async operation of the epoll backend waiting for its fd to be ready
+        struct waiter {
+          std::function<ssize_t()> syscall_op;
+          io_callback callback;
+        };
+
+        struct handler {
+          fd_callback callback;                // add_fd()'s, null while only async operations wait on the fd
+          std::uint32_t user_events{0};        // add_fd()'s mask
+          std::uint32_t events{0};             // registered mask: user_events and what the waiters need
+          std::uint32_t generation{0};
+          bool owned{false};                   // fd created (and closed) by the loop, i.e timers
+          std::deque<waiter> readers, writers; // in submission order
+        };
+
+        int dispatch_epoll(int timeout_ms) {
+          epoll_event events[64];
+          const int n = epoll_wait(m_epoll_fd, events, 64, timeout_ms);
+          if(n < 0) {
+            if(errno != EINTR)
+              dlog::error("epoll_wait failed: " + std::string(std::strerror(errno)));
+            return 0;
+          }
+          for(int i = 0; i < n; i++) {
+            const int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+            const std::uint32_t generation = static_cast<std::uint32_t>(events[i].data.u64 >> 32);
+            auto it = m_handlers.find(fd);
+            // The fd may have been removed (or removed then re-added) by a previous callback of this batch.
+            if(it == m_handlers.end() || it->second->generation != generation) continue;
+            std::shared_ptr<handler> h = it->second; // keep callback alive if it removes itself
+            dispatch(fd, *h, events[i].events);
+          }
+          return n;
+        }
+
+        /**
+         * Retry the waiting async operations first (their results are deferred, they never run user code here),
+         * then call add_fd()'s callback with the events it asked for.
+         */
+        void dispatch(int fd, handler& h, std::uint32_t events) {
+          const std::uint32_t failed = events & (EPOLLERR | EPOLLHUP);
+          const bool waiting = !h.readers.empty() || !h.writers.empty();
+          if(!h.readers.empty() && (events & (EPOLLIN | failed))) retry(h.readers);
+          if(!h.writers.empty() && (events & (EPOLLOUT | failed))) retry(h.writers);
+          if(h.callback && (events & (h.user_events | failed))) h.callback(events & (h.user_events | failed));
+          // Unless the callback removed the fd, or watched it again, stop polling for the operations done.
+          auto it = m_handlers.find(fd);
+          if(waiting && it != m_handlers.end() && it->second.get() == &h) update_events(fd, h, false);
+        }
+
+        void retry(std::deque<waiter>& waiters) {
+          while(!waiters.empty()) {
+            waiter& w = waiters.front();
+            const ssize_t r = w.syscall_op();
+            if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            const std::int32_t result = r < 0 ? -errno : static_cast<std::int32_t>(r);
+            defer_result(std::move(w.callback), result);
+            waiters.pop_front();
+          }
+        }
+
+        /**
+         * Register h's mask: add_fd()'s plus EPOLLIN/EPOLLOUT while operations wait. A registration left without
+         * callback nor waiters is removed.
+         * @param rekey: the generation changed, update the registration even if the mask did not
+         */
+        bool update_events(int fd, handler& h, bool rekey) {
+          std::uint32_t events = h.user_events;
+          if(!h.readers.empty()) events |= EPOLLIN;
+          if(!h.writers.empty()) events |= EPOLLOUT;
+          if(!h.callback && !events) {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            m_handlers.erase(fd);
+            return true;
+          }
+          if(events == h.events && !rekey) return true;
+          epoll_event ev{};
+          ev.events = events;
+          ev.data.u64 = key(fd, h.generation);
+          if(epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            dlog::error("Could not modify fd " + std::to_string(fd) + " events: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          h.events = events;
+          return true;
+        }
+
+#if DAEMONPP_HAVE_IO_URING
+        /**
+         * io_uring backend iteration: submit every queued operation and wait for completions in one io_uring_enter().
+         * The epoll fd is polled by the ring, so watched fds, timers and wake ups are dispatched as well.
+         */
+        int run_ring_once(int timeout_ms) {
+          if(!m_epoll_polled) {
+            io_uring_sqe* sqe = m_ring->get_sqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = m_epoll_fd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = EPOLL_POLL_TAG;
+            m_epoll_polled = true;
+          }
+          __kernel_timespec timeout{};
+          timeout.tv_sec = timeout_ms / 1000;
+          timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000LL;
+          m_ring->submit_and_wait(timeout_ms == 0 ? 0 : 1, timeout_ms < 0 ? nullptr : &timeout);
+
+          int dispatched = 0;
+          bool epoll_ready = false;
+          std::uint64_t user_data[64];
+          std::int32_t results[64];
+          unsigned n;
+          while((n = m_ring->pop_completions(user_data, results, 64)) > 0) {
+            for(unsigned i = 0; i < n; i++) {
+              if(user_data[i] == EPOLL_POLL_TAG) {
+                m_epoll_polled = false;
+                epoll_ready = true;
+                continue;
+              }
+              std::unique_ptr<io_op> op(reinterpret_cast<io_op*>(user_data[i]));
+              op->callback(results[i]);
+              dispatched++;
+            }
+          }
+          if(epoll_ready) dispatched += dispatch_epoll(0);
+          return dispatched;
+        }
+
+        io_uring_sqe* queue_op(io_callback callback) {
+          io_uring_sqe* sqe = m_ring->get_sqe();
+          io_op* op = new io_op();
+          op->callback = std::move(callback);
+          sqe->user_data = reinterpret_cast<std::uint64_t>(op);
+          return sqe;
+        }
+
+        static void prep_rw(io_uring_sqe* sqe, int fd, const void* buf, std::size_t len, std::int64_t offset) {
+          sqe->fd = fd;
+          sqe->addr = reinterpret_cast<std::uint64_t>(buf);
+          sqe->len = static_cast<std::uint32_t>(len);
+          sqe->off = static_cast<std::uint64_t>(offset); // -1 means current file position
+        }
+#endif
+
+        /**
+         * epoll backend: run the syscall, if it would block wait for readiness then retry (see dispatch()).
+         * Behind operations already waiting in the same direction, it waits without trying to keep their order.
+         */
+        void emulate(int fd, std::uint32_t events, std::function<ssize_t()> syscall_op, io_callback callback) {
+          auto it = m_handlers.find(fd);
+          std::deque<waiter>* waiters = nullptr;
+          if(it != m_handlers.end()) waiters = events == EPOLLIN ? &it->second->readers : &it->second->writers;
+          if(!waiters || waiters->empty()) {
+            const ssize_t r = syscall_op();
+            if(r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+              defer_result(std::move(callback), r < 0 ? -errno : static_cast<std::int32_t>(r));
+              return;
+            }
+          }
+          if(it == m_handlers.end()) {
+            if(!add_handler(fd, 0, nullptr, false)) {
+              defer_result(std::move(callback), -EBADF);
+              return;
+            }
+            it = m_handlers.find(fd);
+            waiters = events == EPOLLIN ? &it->second->readers : &it->second->writers;
+          }
+          waiters->push_back(waiter{std::move(syscall_op), std::move(callback)});
+          if(!update_events(fd, *it->second, false)) {
+            io_callback failed = std::move(waiters->back().callback);
+            waiters->pop_back();
+            update_events(fd, *it->second, false);
+            defer_result(std::move(failed), -EBADF);
+          }
+        }
+
+        /**
+         * Completion callbacks are never called inline, they run at the end of the loop iteration.
+         */
+        void defer_result(io_callback callback, std::int32_t result) {
+          m_deferred.emplace_back([callback, result]() { callback(result); });
+        }
+
+        void run_deferred() {
+          while(!m_deferred.empty()) {
+            std::vector<task> deferred;
+            deferred.swap(m_deferred);
+            for(task& t : deferred) t();
+          }
+        }
+
+        bool add_handler(int fd, std::uint32_t events, fd_callback callback, bool owned) {
+          if(m_handlers.count(fd)) {
+            dlog::error("fd " + std::to_string(fd) + " is already watched by the event loop.");
+            return false;
+          }
+          std::shared_ptr<handler> h = std::make_shared<handler>();
+          h->callback = std::move(callback);
+          h->user_events = events;
+          h->events = events;
+          h->generation = ++m_generation;
+          h->owned = owned;
+          epoll_event ev{};
+          ev.events = events;
+          ev.data.u64 = key(fd, h->generation);
+          if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            dlog::error("Could not watch fd " + std::to_string(fd) + ": " + std::string(std::strerror(errno)));
+            return false;
+          }
+          m_handlers[fd] = std::move(h);
+          return true;
+        }
+
+        /**
+         * Replace the file description behind fd with a freshly created one, keeping the fd number.
+         */
+        static bool renew(int fd, int fresh) {
+          if(fresh < 0 || dup3(fresh, fd, O_CLOEXEC) < 0) {
+            dlog::error("Could not renew fd " + std::to_string(fd) + ": " + std::string(std::strerror(errno)));
+            if(fresh >= 0) ::close(fresh);
+            return false;
+          }
+          ::close(fresh);
+          return true;
+        }
+
+        bool arm(int timer_id, const itimerspec& spec, int flags) {
+          if(timerfd_settime(timer_id, flags, &spec, nullptr) < 0) {
+            dlog::error("Could not arm timer " + std::to_string(timer_id) + ": " + std::string(std::strerror(errno)));
+            return false;
+          }
+          return true;
+        }
+
+        void run_posted() {
+          std::vector<task> tasks;
+          {
+            std::lock_guard<std::mutex> lock(m_posted_mutex);
+            tasks.swap(m_posted);
+          }
+          for(task& t : tasks) t();
+        }
+
+        static std::uint64_t key(int fd, std::uint32_t generation) noexcept {
+          return (static_cast<std::uint64_t>(generation) << 32) | static_cast<std::uint32_t>(fd);
+        }
+
+        template<typename Rep, typename Period>
+        static timespec to_timespec(const std::chrono::duration<Rep, Period>& d) noexcept {
+          const auto ns = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), std::chrono::nanoseconds::rep(0));
+          timespec ts{};
+          ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+          ts.tv_nsec = static_cast<long>(ns % 1000000000);
+          return ts;
+        }
+
+    private:
+        int m_epoll_fd{-1};
+        int m_wakeup_fd{-1};
+        std::uint32_t m_generation{0};
+        bool m_stopped{false};
+        std::unordered_map<int, std::shared_ptr<handler>> m_handlers;
+        std::mutex m_posted_mutex;
+        std::vector<task> m_posted;
+        std::vector<task> m_deferred;
+#if DAEMONPP_HAVE_IO_URING
+        std::unique_ptr<during> m_ring;
+        bool m_epoll_polled{false};
+#endif
+        std::vector<iovec> m_buffers;
+    };
+} // !namespace daemonpp
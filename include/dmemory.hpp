@@ -0,0 +1,172 @@
+#pragma once
+#include <unistd.h>
+#include <alloca.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "dlog.hpp"
+
+namespace daemonpp {
+  /**
+   * Memory residency helpers for latency critical daemons: no page fault on first touch, no swap out while idle.
+   */
+  class dmemory {
+    public:
+        /**
+         * Lock the current and future pages of the process in RAM (mlockall(MCL_CURRENT | MCL_FUTURE)).
+         * @param on_fault: with MCL_ONFAULT, pages are locked once touched instead of all at once (Linux 4.4+)
+         * @return false on failure, logged with the RLIMIT_MEMLOCK limit to raise (LimitMEMLOCK= in the .service file)
+         */
+        static bool lock_all(bool on_fault = false) {
+          int flags = MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+          if(on_fault) flags |= MCL_ONFAULT;
+#endif
+          if(mlockall(flags) == 0) return true;
+          const int error = errno;
+          rlimit limit{};
+          getrlimit(RLIMIT_MEMLOCK, &limit);
+          const std::string current = limit.rlim_cur == RLIM_INFINITY ? "unlimited" : std::to_string(limit.rlim_cur / 1024) + " KiB";
+          dlog::error("Could not lock memory: " + std::string(std::strerror(error)) + " (RLIMIT_MEMLOCK is " + current +
+                      "), set LimitMEMLOCK=infinity in the .service file or grant CAP_IPC_LOCK.");
+          return false;
+        }
+
+        /**
+         * Touch `bytes` of stack so the calling thread's stack pages are mapped (and locked with lock_all()) up front.
+         */
+        static void prefault_stack(std::size_t bytes) {
+          touch_stack(bytes);
+        }
+
+        /**
+         * Map `bytes` of heap up front and keep it: malloc() no longer trims the heap nor uses mmap() for large
+         * blocks, so later allocations reuse these already faulted (and locked with lock_all()) pages.
+         */
+        static void prefault_heap(std::size_t bytes) {
+          mallopt(M_TRIM_THRESHOLD, -1);
+          mallopt(M_MMAP_MAX, 0);
+          char* reserve = static_cast<char*>(std::malloc(bytes));
+          if(!reserve) {
+            dlog::error("Could not prefault " + std::to_string(bytes) + " bytes of heap.");
+            return;
+          }
+          const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+          for(std::size_t i = 0; i < bytes; i += page)
+            reinterpret_cast<volatile char*>(reserve)[i] = 0;
+          std::free(reserve);
+        }
+
+    private:
+        static void __attribute__((noinline)) touch_stack(std::size_t bytes) {
+          volatile char* stack = static_cast<volatile char*>(alloca(bytes));
+          const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+          for(std::size_t i = 0; i < bytes; i += page)
+            stack[i] = 0;
+        }
+  };
+
+  /**
+   * Fixed size bump allocator over its own mapping, optionally backed by huge pages to cut TLB misses
+   * on large buffers (rings, tables, caches) and prefaulted so first touch does not fault.
+   * Allocations live until reset() or the arena's destruction.
+   */
+  class darena {
+    public:
+        enum class huge_pages {
+          none,        ///< regular pages
+          transparent, ///< madvise(MADV_HUGEPAGE), needs /sys/kernel/mm/transparent_hugepage/enabled set to madvise or always
+          hugetlb      ///< MAP_HUGETLB from the reserved pool (vm.nr_hugepages), falls back to transparent when exhausted
+        };
+
+    public:
+        /**
+         * @param size: arena size, rounded up to the (huge) page size
+         * @param mode: huge pages backing
+         * @param prefault: fault every page in now (MAP_POPULATE)
+         */
+        explicit darena(std::size_t size, huge_pages mode = huge_pages::transparent, bool prefault = true) {
+          const int populate = prefault ? MAP_POPULATE : 0;
+          if(mode == huge_pages::hugetlb) {
+            m_size = round_up(size, HUGE_PAGE_SIZE);
+            m_data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+            if(m_data == MAP_FAILED) {
+              dlog::notice("Could not map " + std::to_string(m_size) + " bytes of explicit huge pages (vm.nr_hugepages): " +
+                           std::string(std::strerror(errno)) + ", falling back to transparent huge pages.");
+              m_data = nullptr;
+              mode = huge_pages::transparent;
+            }
+          }
+          if(!m_data) {
+            m_size = round_up(size, mode == huge_pages::transparent ? HUGE_PAGE_SIZE : static_cast<std::size_t>(sysconf(_SC_PAGESIZE)));
+            // Advise before populating so the pages are faulted in as huge pages.
+            m_data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(m_data == MAP_FAILED) {
+              dlog::error("Could not map a " + std::to_string(m_size) + " bytes arena: " + std::string(std::strerror(errno)));
+              m_data = nullptr;
+              m_size = 0;
+              return;
+            }
+            if(mode == huge_pages::transparent && madvise(m_data, m_size, MADV_HUGEPAGE) < 0)
+              dlog::notice("Transparent huge pages are not available: " + std::string(std::strerror(errno)));
+            if(prefault) {
+#ifdef MADV_POPULATE_WRITE
+              if(madvise(m_data, m_size, MADV_POPULATE_WRITE) < 0)
+#endif
+              {
+                const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+                for(std::size_t i = 0; i < m_size; i += page)
+                  static_cast<volatile char*>(m_data)[i] = 0;
+              }
+            }
+          }
+          m_mode = mode;
+        }
+
+        darena(const darena&) = delete;
+        darena& operator=(const darena&) = delete;
+
+        ~darena() {
+          if(m_data) munmap(m_data, m_size);
+        }
+
+        /**
+         * @return `bytes` of memory aligned to `alignment` (a power of two), nullptr when the arena is full
+         */
+        void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) noexcept {
+          const std::size_t offset = round_up(m_used, alignment);
+          if(!m_data || offset + bytes > m_size) return nullptr;
+          m_used = offset + bytes;
+          return static_cast<char*>(m_data) + offset;
+        }
+
+        /**
+         * Free every allocation at once, the pages stay mapped.
+         */
+        void reset() noexcept { m_used = 0; }
+
+        void* data() const noexcept { return m_data; }
+        std::size_t size() const noexcept { return m_size; }
+        std::size_t used() const noexcept { return m_used; }
+        huge_pages get_mode() const noexcept { return m_mode; }
+
+    private:
+        static constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        static std::size_t round_up(std::size_t value, std::size_t multiple) noexcept {
+          return (value + multiple - 1) / multiple * multiple;
+        }
+
+    private:
+        void* m_data{nullptr};
+        std::size_t m_size{0};
+        std::size_t m_used{0};
+        huge_pages m_mode{huge_pages::none};
+  };
+} // !namespace daemonpp
@@ -0,0 +1,373 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "dlog.hpp"
+
+namespace daemonpp {
+  /**
+   * Process wide metrics registry: counters, gauges and log-linear (HDR style) histograms.
+   *
+   * Updates are lock free: counters and histograms are split in per thread shards, each on its own cache lines,
+   * updated with relaxed atomics and only summed when the registry is scraped with collect().
+   * Registration takes a lock, so look a metric up once and keep the returned reference, it stays valid forever:
+   *
+   *   dmetrics::counter& errors = dmetrics::get_counter("my_daemon_errors_total", "Failed requests");
+   *   dmetrics::histogram& latency = dmetrics::get_histogram("my_daemon_request_seconds", "Request latency", 1e-9);
+   *   errors.inc();
+   *   latency.record(std::chrono::steady_clock::now() - begin);
+   *
+   * @note: a name may carry Prometheus labels, e.g "my_daemon_requests_total{code=\"500\"}", each label set being its own series.
+   */
+  class dmetrics {
+    public:
+        static constexpr std::size_t SHARDS = 16;
+        static constexpr std::size_t CACHE_LINE = 64;
+
+        /**
+         * Monotonic counter.
+         */
+        class counter {
+          public:
+              counter() = default;
+              counter(const counter&) = delete;
+              counter& operator=(const counter&) = delete;
+
+              void inc(std::uint64_t n = 1) noexcept {
+                m_shards[shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+              }
+
+              /**
+               * Sum of the shards, concurrent inc() may or may not be counted yet.
+               */
+              std::uint64_t value() const noexcept {
+                std::uint64_t total = 0;
+                for(const shard& s : m_shards)
+                  total += s.value.load(std::memory_order_relaxed);
+                return total;
+              }
+
+          private:
+              struct alignas(CACHE_LINE) shard {
+                std::atomic<std::uint64_t> value{0};
+              };
+              shard m_shards[SHARDS];
+        };
+
+        /**
+         * Value going up and down (queue depth, connections, bytes in use), last set() wins.
+         */
+        class gauge {
+          public:
+              gauge() = default;
+              gauge(const gauge&) = delete;
+              gauge& operator=(const gauge&) = delete;
+
+              void set(std::int64_t value) noexcept { m_value.store(value, std::memory_order_relaxed); }
+              void add(std::int64_t delta) noexcept { m_value.fetch_add(delta, std::memory_order_relaxed); }
+              void sub(std::int64_t delta) noexcept { m_value.fetch_sub(delta, std::memory_order_relaxed); }
+              std::int64_t value() const noexcept { return m_value.load(std::memory_order_relaxed); }
+
+          private:
+              alignas(CACHE_LINE) std::atomic<std::int64_t> m_value{0};
+        };
+
+        /**
+         * Log-linear histogram of unsigned integer values (e.g nanoseconds): each power of two is split in
+         * SUB_BUCKETS linear buckets, so any recorded value is known within 1/SUB_BUCKETS (6.25%) relative error
+         * from 1 to 2^MAX_BITS (18 minutes in nanoseconds), larger values land in the last bucket.
+         */
+        class histogram {
+          public:
+              static constexpr std::size_t SUB_BITS = 4;
+              static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BITS;
+              static constexpr std::size_t MAX_BITS = 40;
+              static constexpr std::size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS + 1; // + overflow bucket
+
+              /// Merged view of the shards at scrape time.
+              struct snapshot {
+                std::uint64_t count{0};
+                std::uint64_t sum{0};
+                std::vector<std::uint64_t> buckets; ///< count per bucket index, see bucket_upper()
+
+                /**
+                 * Upper bound of the bucket holding the q-th quantile (0.0 to 1.0), 0 when empty.
+                 */
+                std::uint64_t quantile(double q) const noexcept {
+                  if(count == 0) return 0;
+                  const double rank = q * static_cast<double>(count);
+                  std::uint64_t seen = 0;
+                  for(std::size_t i = 0; i < buckets.size(); i++) {
+                    seen += buckets[i];
+                    if(buckets[i] > 0 && static_cast<double>(seen) >= rank) return bucket_upper(i);
+                  }
+                  return bucket_upper(buckets.size() - 1);
+                }
+
+                double mean() const noexcept {
+                  return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count);
+                }
+              };
+
+          public:
+              /**
+               * @param scale: unit of the exported values per recorded unit, e.g 1e-9 to record nanoseconds and export seconds
+               */
+              explicit histogram(double scale = 1.0) : m_scale(scale) {}
+              histogram(const histogram&) = delete;
+              histogram& operator=(const histogram&) = delete;
+
+              void record(std::uint64_t value) noexcept {
+                shard& s = m_shards[shard_index()];
+                s.buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+                s.sum.fetch_add(value, std::memory_order_relaxed);
+                s.count.fetch_add(1, std::memory_order_relaxed);
+              }
+
+              /**
+               * Record a duration in nanoseconds, negative durations count as 0.
+               */
+              template<typename Rep, typename Period>
+              void record(const std::chrono::duration<Rep, Period>& duration) noexcept {
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+                record(ns > 0 ? static_cast<std::uint64_t>(ns) : 0);
+              }
+
+              snapshot get_snapshot() const {
+                snapshot snap;
+                snap.buckets.assign(BUCKETS, 0);
+                for(const shard& s : m_shards) {
+                  snap.count += s.count.load(std::memory_order_relaxed);
+                  snap.sum += s.sum.load(std::memory_order_relaxed);
+                  for(std::size_t i = 0; i < BUCKETS; i++)
+                    snap.buckets[i] += s.buckets[i].load(std::memory_order_relaxed);
+                }
+                return snap;
+              }
+
+              double get_scale() const noexcept { return m_scale; }
+
+              static std::size_t bucket_index(std::uint64_t value) noexcept {
+                if(value < SUB_BUCKETS) return static_cast<std::size_t>(value);
+                const std::size_t msb = 63 - static_cast<std::size_t>(__builtin_clzll(value));
+                if(msb >= MAX_BITS) return BUCKETS - 1;
+                const std::size_t shift = msb - SUB_BITS;
+                return (shift + 1) * SUB_BUCKETS + static_cast<std::size_t>((value >> shift) & (SUB_BUCKETS - 1));
+              }
+
+              /**
+               * Largest value falling in the bucket.
+               */
+              static std::uint64_t bucket_upper(std::size_t index) noexcept {
+                if(index < SUB_BUCKETS) return index;
+                if(index >= BUCKETS - 1) return UINT64_MAX;
+                const std::size_t shift = index / SUB_BUCKETS - 1;
+                const std::uint64_t lower = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+                return lower + (std::uint64_t(1) << shift) - 1;
+              }
+
+          private:
+              struct alignas(CACHE_LINE) shard {
+                std::atomic<std::uint64_t> count{0};
+                std::atomic<std::uint64_t> sum{0};
+                std::atomic<std::uint64_t> buckets[BUCKETS]{};
+              };
+              shard m_shards[SHARDS];
+              double m_scale;
+        };
+
+        enum class type { counter, gauge, histogram };
+
+        /// One series as collected at scrape time.
+        struct sample {
+          std::string name;          ///< series name, with its labels if any
+          std::string help;
+          type kind{type::counter};
+          double value{0.0};         ///< counter and gauge value
+          double scale{1.0};         ///< histogram unit, see histogram::histogram()
+          histogram::snapshot hist;  ///< histogram buckets
+
+          /**
+           * Name without the labels, e.g "requests_total" for "requests_total{code=\"500\"}".
+           */
+          std::string family() const { return name.substr(0, name.find('{')); }
+        };
+
+    public:
+        /**
+         * Find or register the counter `name`.
+         */
+        static counter& get_counter(const std::string& name, const std::string& help = "") {
+          return find_or_add(m_counters, name, help, [](std::deque<counter>& store) -> counter& { store.emplace_back(); return store.back(); });
+        }
+
+        /**
+         * Find or register the gauge `name`.
+         */
+        static gauge& get_gauge(const std::string& name, const std::string& help = "") {
+          return find_or_add(m_gauges, name, help, [](std::deque<gauge>& store) -> gauge& { store.emplace_back(); return store.back(); });
+        }
+
+        /**
+         * Find or register the histogram `name`.
+         * @param scale: see histogram::histogram(), only used when registering
+         */
+        static histogram& get_histogram(const std::string& name, const std::string& help = "", double scale = 1.0) {
+          return find_or_add(m_histograms, name, help, [scale](std::deque<histogram>& store) -> histogram& { store.emplace_back(scale); return store.back(); });
+        }
+
+        /**
+         * Register a gauge computed when scraped, e.g from a queue size. Replaces the callback already set for `name`.
+         * @note: fn runs on the scraping thread, the daemon's HTTP server thread for /metrics: read atomics, or lock
+         * what the daemon's thread updates.
+         */
+        static void set_gauge_callback(const std::string& name, const std::string& help, std::function<double()> fn) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_callbacks[name] = std::make_pair(help, std::move(fn));
+        }
+
+        /**
+         * Merge the shards of every metric, sorted by family then name so the series of a family are adjacent.
+         */
+        static std::vector<sample> collect() {
+          std::vector<std::pair<std::string, std::function<double()>>> callbacks;
+          std::map<std::string, sample> samples;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(const auto& c : m_counters.index) {
+              sample& s = samples[c.first];
+              s.kind = type::counter;
+              s.help = c.second.help;
+              s.value = static_cast<double>(c.second.metric->value());
+            }
+            for(const auto& g : m_gauges.index) {
+              sample& s = samples[g.first];
+              s.kind = type::gauge;
+              s.help = g.second.help;
+              s.value = static_cast<double>(g.second.metric->value());
+            }
+            for(const auto& h : m_histograms.index) {
+              sample& s = samples[h.first];
+              s.kind = type::histogram;
+              s.help = h.second.help;
+              s.scale = h.second.metric->get_scale();
+              s.hist = h.second.metric->get_snapshot();
+            }
+            for(const auto& cb : m_callbacks) {
+              samples[cb.first].help = cb.second.first;
+              callbacks.emplace_back(cb.first, cb.second.second);
+            }
+          }
+          // Outside the lock, so a callback may look metrics up.
+          for(const auto& cb : callbacks) {
+            sample& s = samples[cb.first];
+            s.kind = type::gauge;
+            s.value = cb.second();
+          }
+          std::vector<sample> result;
+          result.reserve(samples.size());
+          for(auto& s : samples) {
+            s.second.name = s.first;
+            result.push_back(std::move(s.second));
+          }
+          std::stable_sort(result.begin(), result.end(), [](const sample& a, const sample& b) { return a.family() < b.family(); });
+          return result;
+        }
+
+        /**
+         * Append the Prometheus text exposition (format 0.0.4) of a sample to out.
+         * Histograms are exported with one cumulative bucket per power of two.
+         * @param header: also write the # HELP and # TYPE lines, once per family
+         */
+        static void format(const sample& s, bool header, std::string& out) {
+          const std::string family = s.family();
+          const std::size_t brace = s.name.find('{');
+          const std::string labels = brace == std::string::npos ? std::string() : s.name.substr(brace + 1, s.name.size() - brace - 2);
+          if(header) {
+            if(!s.help.empty()) out += "# HELP " + family + " " + s.help + "\n";
+            out += "# TYPE " + family + (s.kind == type::counter ? " counter\n" : s.kind == type::gauge ? " gauge\n" : " histogram\n");
+          }
+          if(s.kind != type::histogram) {
+            out += s.name + " " + number(s.value, s.kind == type::counter ? 17 : 15) + "\n";
+            return;
+          }
+          const std::string prefix = family + "_bucket{" + labels + (labels.empty() ? "" : ",") + "le=\"";
+          std::uint64_t cumulative = 0;
+          for(std::size_t i = 0; i + 1 < histogram::BUCKETS; i++) {
+            cumulative += s.hist.buckets[i];
+            if((i + 1) % histogram::SUB_BUCKETS == 0)
+              out += prefix + number(static_cast<double>(histogram::bucket_upper(i)) * s.scale, 6) + "\"} " + std::to_string(cumulative) + "\n";
+          }
+          // Shards are read while being updated, so count from the buckets to keep +Inf and _count consistent.
+          cumulative += s.hist.buckets[histogram::BUCKETS - 1];
+          out += prefix + "+Inf\"} " + std::to_string(cumulative) + "\n";
+          const std::string suffix = labels.empty() ? std::string() : "{" + labels + "}";
+          out += family + "_sum" + suffix + " " + number(static_cast<double>(s.hist.sum) * s.scale, 15) + "\n";
+          out += family + "_count" + suffix + " " + std::to_string(cumulative) + "\n";
+        }
+
+    private:
+        template<typename M>
+        struct registry {
+          struct entry {
+            M* metric;
+            std::string help;
+          };
+          std::deque<M> store; // never moves its elements, so references stay valid
+          std::map<std::string, entry> index;
+        };
+
+        template<typename M, typename F>
+        static M& find_or_add(registry<M>& reg, const std::string& name, const std::string& help, F&& make) {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          auto it = reg.index.find(name);
+          if(it != reg.index.end()) return *it->second.metric;
+          if(is_registered(name))
+            dlog::error("Metric '" + name + "' is already registered with another type.");
+          M& metric = make(reg.store);
+          reg.index.emplace(name, typename registry<M>::entry{&metric, help});
+          return metric;
+        }
+
+        static std::string number(double value, int precision) {
+          char text[32];
+          std::snprintf(text, sizeof(text), "%.*g", precision, value);
+          return text;
+        }
+
+        static bool is_registered(const std::string& name) {
+          return m_counters.index.count(name) || m_gauges.index.count(name) || m_histograms.index.count(name) || m_callbacks.count(name);
+        }
+
+        /**
+         * Shard of the calling thread, threads are spread round robin on their first update.
+         */
+        static std::size_t shard_index() noexcept {
+          static thread_local const std::size_t index = m_next_shard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+          return index;
+        }
+
+    private:
+        static std::mutex m_mutex;
+        static registry<counter> m_counters;
+        static registry<gauge> m_gauges;
+        static registry<histogram> m_histograms;
+        static std::map<std::string, std::pair<std::string, std::function<double()>>> m_callbacks;
+        static std::atomic<std::size_t> m_next_shard;
+  };
+  std::mutex dmetrics::m_mutex{};
+  dmetrics::registry<dmetrics::counter> dmetrics::m_counters{};
+  dmetrics::registry<dmetrics::gauge> dmetrics::m_gauges{};
+  dmetrics::registry<dmetrics::histogram> dmetrics::m_histograms{};
+  std::map<std::string, std::pair<std::string, std::function<double()>>> dmetrics::m_callbacks{};
+  std::atomic<std::size_t> dmetrics::m_next_shard{0};
+} // !namespace daemonpp
@@ -0,0 +1,175 @@
+#pragma once
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "dlog.hpp"
+
+namespace daemonpp {
+  /**
+   * systemd service notifications (sd_notify protocol) without libsystemd:
+   * datagrams of newline separated VAR=value assignments sent to the unix socket in $NOTIFY_SOCKET.
+   * All calls are no-ops when the daemon is not started by systemd with Type=notify.
+   */
+  class dnotify {
+    public:
+        /**
+         * @return true if systemd listens to our notifications ($NOTIFY_SOCKET is set)
+         */
+        static bool is_enabled() {
+          const char* socket_path = std::getenv("NOTIFY_SOCKET");
+          return socket_path && (socket_path[0] == '/' || socket_path[0] == '@');
+        }
+
+        /**
+         * Send raw state assignments, e.g "READY=1\nSTATUS=Warming up"
+         * @return false if not enabled or on failure (logged)
+         */
+        static bool notify(const std::string& state) {
+          const char* socket_path = std::getenv("NOTIFY_SOCKET");
+          if(!socket_path || (socket_path[0] != '/' && socket_path[0] != '@')) return false;
+
+          sockaddr_un addr{};
+          addr.sun_family = AF_UNIX;
+          const std::size_t length = std::strlen(socket_path);
+          if(length >= sizeof(addr.sun_path)) {
+            dlog::error("NOTIFY_SOCKET path is too long.");
+            return false;
+          }
+          std::memcpy(addr.sun_path, socket_path, length);
+          if(addr.sun_path[0] == '@') addr.sun_path[0] = '\0'; // abstract namespace socket
+          const socklen_t addr_len = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + length);
+
+          int& fd = socket_fd();
+          if(fd < 0) {
+            fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if(fd < 0) {
+              dlog::error("Could not create notify socket: " + std::string(std::strerror(errno)));
+              return false;
+            }
+          }
+          if(sendto(fd, state.data(), state.size(), MSG_NOSIGNAL, reinterpret_cast<const sockaddr*>(&addr), addr_len) < 0) {
+            dlog::error("Could not notify systemd: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          return true;
+        }
+
+        /**
+         * Startup finished, dependent units may start now.
+         */
+        static bool ready() { return notify("READY=1"); }
+
+        /**
+         * Reloading configuration, call ready() when done.
+         */
+        static bool reloading() {
+          timespec now{};
+          clock_gettime(CLOCK_MONOTONIC, &now);
+          const std::uint64_t usec = static_cast<std::uint64_t>(now.tv_sec) * 1000000u + static_cast<std::uint64_t>(now.tv_nsec) / 1000u;
+          return notify("RELOADING=1\nMONOTONIC_USEC=" + std::to_string(usec));
+        }
+
+        /**
+         * Shutting down.
+         */
+        static bool stopping() { return notify("STOPPING=1"); }
+
+        /**
+         * Free form status shown by `systemctl status`.
+         */
+        static bool status(const std::string& text) { return notify("STATUS=" + text); }
+
+        /**
+         * Keep alive ping, must be sent at least every watchdog_interval().
+         */
+        static bool watchdog() { return notify("WATCHDOG=1"); }
+
+        /**
+         * Change the main pid tracked by systemd (requires NotifyAccess=all when sent by another process).
+         */
+        static bool mainpid(pid_t pid) { return notify("MAINPID=" + std::to_string(pid)); }
+
+        /**
+         * Watchdog interval from $WATCHDOG_USEC (WatchdogSec= in the .service file), zero if disabled
+         * or if the watchdog is meant for another process ($WATCHDOG_PID).
+         */
+        static std::chrono::microseconds watchdog_interval() {
+          const char* usec = std::getenv("WATCHDOG_USEC");
+          if(!usec) return std::chrono::microseconds::zero();
+          const char* pid = std::getenv("WATCHDOG_PID");
+          if(pid && std::strtol(pid, nullptr, 10) != static_cast<long>(getpid()))
+            return std::chrono::microseconds::zero();
+          return std::chrono::microseconds(std::strtoull(usec, nullptr, 10));
+        }
+
+        /**
+         * Listening sockets passed by systemd socket activation ($LISTEN_FDS, starting at fd 3), with their names
+         * from $LISTEN_FDNAMES (FileDescriptorName= in the .socket file, "unknown" when not set).
+         * The fds are made close-on-exec and the variables are unset so children don't inherit them.
+         * @note: must be called before forking, systemd checks them against our pid ($LISTEN_PID).
+         */
+        static std::vector<std::pair<std::string, int>> listen_fds() {
+          std::vector<std::pair<std::string, int>> fds;
+          const char* pid = std::getenv("LISTEN_PID");
+          const char* count = std::getenv("LISTEN_FDS");
+          if(!pid || !count || std::strtol(pid, nullptr, 10) != static_cast<long>(getpid())) return fds;
+          const long n = std::strtol(count, nullptr, 10);
+          std::vector<std::string> names;
+          if(const char* fd_names = std::getenv("LISTEN_FDNAMES")) {
+            std::string name;
+            for(const char* c = fd_names; ; c++) {
+              if(*c == ':' || *c == '\0') {
+                names.push_back(name);
+                name.clear();
+                if(*c == '\0') break;
+              }
+              else name += *c;
+            }
+          }
+          for(long i = 0; i < n; i++) {
+            const int fd = LISTEN_FDS_START + static_cast<int>(i);
+            const std::string name = static_cast<std::size_t>(i) < names.size() ? names[static_cast<std::size_t>(i)] : "unknown";
+            const int flags = fcntl(fd, F_GETFD);
+            if(flags < 0) {
+              dlog::error("Inherited listening fd " + std::to_string(fd) + " is invalid: " + std::string(std::strerror(errno)));
+              continue;
+            }
+            fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+            fds.emplace_back(name, fd);
+          }
+          unsetenv("LISTEN_PID");
+          unsetenv("LISTEN_FDS");
+          unsetenv("LISTEN_FDNAMES");
+          return fds;
+        }
+
+        /**
+         * Close the notification socket.
+         */
+        static void shutdown() {
+          int& fd = socket_fd();
+          if(fd >= 0) ::close(fd);
+          fd = -1;
+        }
+
+    private:
+        static constexpr int LISTEN_FDS_START = 3;
+
+        /// Notification socket, opened at the first notify()
+        static int& socket_fd() {
+          static int fd = -1;
+          return fd;
+        }
+  };
+} // !namespace daemonpp
@@ -0,0 +1,295 @@
+#pragma once
+#include <pthread.h>
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <condition_variable>
+#include "dlog.hpp"
+#include "dloop.hpp"
+#include "dcgroup.hpp"
+
+namespace daemonpp {
+  /**
+   * Work stealing thread pool used to offload work from the daemon's thread.
+   * Each worker owns a deque: it pushes and pops its own tasks at the back (LIFO, cache friendly)
+   * while idle workers steal from the front of the others, so there is no single contended queue.
+   */
+  class dpool {
+    public:
+        using task = std::function<void()>;
+
+    public:
+        /**
+         * @param size: number of workers, 0 to size the pool from the CPU quota (see default_size())
+         * @param loop: event loop running continuations of submit(fn, then), may be null
+         */
+        explicit dpool(std::size_t size = 0, dloop* loop = nullptr) : m_loop(loop)
+        {
+          if(size == 0) size = default_size();
+          m_queues.reserve(size);
+          for(std::size_t i = 0; i < size; i++)
+            m_queues.emplace_back(new queue());
+          m_workers.reserve(size);
+          for(std::size_t i = 0; i < size; i++)
+            m_workers.emplace_back(&dpool::worker_loop, this, i);
+        }
+
+        dpool(const dpool&) = delete;
+        dpool& operator=(const dpool&) = delete;
+
+        /**
+         * Finish queued tasks then join workers.
+         */
+        ~dpool() {
+          {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            m_stopping = true;
+          }
+          m_sleep_cv.notify_all();
+          for(std::thread& worker : m_workers)
+            if(worker.joinable()) worker.join();
+        }
+
+        /**
+         * Run fn on a worker.
+         * @return future of fn's result (or exception)
+         */
+        template<typename F>
+        auto submit(F&& fn) -> std::future<decltype(std::declval<typename std::decay<F>::type&>()())> {
+          using result_type = decltype(std::declval<typename std::decay<F>::type&>()());
+          std::shared_ptr<std::packaged_task<result_type()>> packaged = std::make_shared<std::packaged_task<result_type()>>(std::forward<F>(fn));
+          std::future<result_type> future = packaged->get_future();
+          push([packaged]() { (*packaged)(); });
+          return future;
+        }
+
+        /**
+         * Run fn on a worker, then its continuation on the daemon's loop thread with fn's result.
+         * Exceptions thrown by fn are logged and the continuation is not called.
+         * @param fn: work to offload, returning R
+         * @param then: continuation called with R (or without arguments when R is void)
+         */
+        template<typename F, typename C>
+        void submit(F&& fn, C&& then) {
+          using result_type = decltype(std::declval<typename std::decay<F>::type&>()());
+          typename std::decay<F>::type work(std::forward<F>(fn));
+          typename std::decay<C>::type continuation(std::forward<C>(then));
+          dloop* loop = m_loop;
+          push([work, continuation, loop]() mutable {
+            try {
+              continuation_caller<result_type>::call(work, continuation, loop);
+            } catch(const std::exception& e) {
+              dlog::error(std::string("dpool task failed: ") + e.what());
+            }
+          });
+        }
+
+        /**
+         * Call fn(i) for every i in [begin, end) on the workers, split in chunks of `grain` items,
+         * and wait for completion. The calling thread runs chunks of this call too, never other queued tasks, so
+         * calling it from the loop thread does not pick up unrelated (possibly blocking) jobs.
+         * @param grain: items per task, 0 to split evenly in about 4 chunks per worker
+         */
+        template<typename F>
+        void parallel_for(std::size_t begin, std::size_t end, F&& fn, std::size_t grain = 0) {
+          if(begin >= end) return;
+          const std::size_t count = end - begin;
+          if(grain == 0) grain = std::max<std::size_t>(1, count / (m_workers.size() * 4));
+          const std::size_t chunks = (count + grain - 1) / grain;
+          std::shared_ptr<for_state> state = std::make_shared<for_state>();
+          typename std::remove_reference<F>::type* body = &fn;
+          // Chunks are claimed from a shared index: helpers starting once all are claimed return without touching body.
+          auto run_chunks = [state, body, begin, end, grain, chunks]() {
+            for(std::size_t c; (c = state->next.fetch_add(1, std::memory_order_relaxed)) < chunks;) {
+              const std::size_t first = begin + c * grain;
+              const std::size_t last = std::min(end, first + grain);
+              try {
+                for(std::size_t i = first; i < last; i++) (*body)(i);
+              } catch(...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if(!state->error) state->error = std::current_exception();
+              }
+              if(state->done.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+              }
+            }
+          };
+          const std::size_t helpers = std::min(m_workers.size(), chunks - 1);
+          for(std::size_t h = 0; h < helpers; h++)
+            push(run_chunks);
+          // Run chunks here too: completes even if every worker is busy, or parallel_for() is called from one.
+          run_chunks();
+          std::unique_lock<std::mutex> lock(state->mutex);
+          state->finished.wait(lock, [&state, chunks]() { return state->done.load(std::memory_order_acquire) == chunks; });
+          if(state->error) std::rethrow_exception(state->error);
+        }
+
+        std::size_t get_size() const noexcept { return m_workers.size(); }
+
+        /**
+         * Run setup(worker index) on every worker thread, now (at their next wake up) and on workers started later,
+         * e.g to set their CPU affinity or scheduling priority which only apply to the calling thread.
+         * Replaces the previous setup.
+         */
+        void set_thread_setup(std::function<void(std::size_t index)> setup) {
+          {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            m_setup = std::make_shared<std::function<void(std::size_t)>>(std::move(setup));
+            m_setup_generation++;
+          }
+          m_sleep_cv.notify_all();
+        }
+
+        /**
+         * Number of workers that fits the CPU quota of this process (see dcgroup::available_cpus()).
+         */
+        static std::size_t default_size() {
+          return dcgroup::available_cpus();
+        }
+
+    private:
+        struct queue {
+          std::mutex mutex;
+          std::deque<task> tasks;
+        };
+
+        /// Shared by the chunks of a parallel_for() call
+        struct for_state {
+          std::atomic<std::size_t> next{0};  // next chunk to claim
+          std::atomic<std::size_t> done{0};  // chunks completed
+          std::mutex mutex;
+          std::condition_variable finished;
+          std::exception_ptr error;
+        };
+
+        template<typename R>
+        struct continuation_caller {
+          template<typename W, typename C>
+          static void call(W& work, C& continuation, dloop* loop) {
+            std::shared_ptr<R> result = std::make_shared<R>(work());
+            if(loop) loop->post([continuation, result]() mutable { continuation(std::move(*result)); });
+            else continuation(std::move(*result));
+          }
+        };
+
+        /// Identifies the pool and worker index of the calling thread
+        struct worker_identity {
+          const dpool* pool{nullptr};
+          std::size_t index{0};
+        };
+        static worker_identity& current_worker() {
+          static thread_local worker_identity identity;
+          return identity;
+        }
+
+        void push(task t) {
+          worker_identity& self = current_worker();
+          // Workers push to their own deque, other threads spread tasks round robin.
+          const std::size_t index = self.pool == this ? self.index
+                                  : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+          {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(t));
+          }
+          m_pending.fetch_add(1);
+          if(m_sleeping.load() > 0) {
+            { std::lock_guard<std::mutex> lock(m_sleep_mutex); }
+            m_sleep_cv.notify_one();
+          }
+        }
+
+        bool pop(std::size_t index, task& t) {
+          queue& q = *m_queues[index];
+          std::lock_guard<std::mutex> lock(q.mutex);
+          if(q.tasks.empty()) return false;
+          t = std::move(q.tasks.back());
+          q.tasks.pop_back();
+          return true;
+        }
+
+        /**
+         * Take the oldest task of another worker's deque.
+         * @param thief: index of the stealing worker (its own deque is skipped), or get_size() for non worker threads
+         */
+        bool steal(std::size_t thief, task& t) {
+          const std::size_t count = m_queues.size();
+          for(std::size_t i = 0; i < count; i++) {
+            const std::size_t victim = (thief + 1 + i) % count;
+            if(victim == thief) continue;
+            queue& q = *m_queues[victim];
+            std::unique_lock<std::mutex> lock(q.mutex, std::try_to_lock);
+            if(!lock.owns_lock() || q.tasks.empty()) continue;
+            t = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            return true;
+          }
+          return false;
+        }
+
+        void worker_loop(std::size_t index) {
+          current_worker().pool = this;
+          current_worker().index = index;
+          const std::string name = "dpool-" + std::to_string(index);
+          pthread_setname_np(pthread_self(), name.c_str());
+          std::uint64_t setup_generation = 0;
+          for(;;) {
+            if(m_setup_generation.load() != setup_generation) {
+              std::shared_ptr<std::function<void(std::size_t)>> setup;
+              {
+                std::lock_guard<std::mutex> lock(m_sleep_mutex);
+                setup = m_setup;
+                setup_generation = m_setup_generation.load();
+              }
+              if(setup && *setup) (*setup)(index);
+            }
+            task t;
+            if(pop(index, t) || steal(index, t)) {
+              m_pending.fetch_sub(1);
+              t();
+              continue;
+            }
+            std::unique_lock<std::mutex> lock(m_sleep_mutex);
+            if(m_stopping && m_pending.load() == 0) return;
+            m_sleeping.fetch_add(1);
+            m_sleep_cv.wait(lock, [this, setup_generation]() {
+              return m_stopping || m_pending.load() > 0 || m_setup_generation.load() != setup_generation;
+            });
+            m_sleeping.fetch_sub(1);
+          }
+        }
+
+    private:
+        dloop* m_loop;
+        std::vector<std::unique_ptr<queue>> m_queues;
+        std::vector<std::thread> m_workers;
+        std::atomic<std::size_t> m_next_queue{0};
+        std::atomic<std::size_t> m_pending{0};
+        std::atomic<std::size_t> m_sleeping{0};
+        std::shared_ptr<std::function<void(std::size_t)>> m_setup;
+        std::atomic<std::uint64_t> m_setup_generation{0};
+        std::mutex m_sleep_mutex;
+        std::condition_variable m_sleep_cv;
+        bool m_stopping{false};
+    };
+
+    template<>
+    struct dpool::continuation_caller<void> {
+      template<typename W, typename C>
+      static void call(W& work, C& continuation, dloop* loop) {
+        work();
+        if(loop) loop->post([continuation]() mutable { continuation(); });
+        else continuation();
+      }
+    };
+} // !namespace daemonpp
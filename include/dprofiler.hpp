@@ -0,0 +1,204 @@
+#pragma once
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "dlog.hpp"
+
+namespace daemonpp {
+  /**
+   * Sampling CPU profiler: an ITIMER_PROF interval timer sends SIGPROF every 1/hz second of process CPU time to
+   * the thread burning it, whose handler stores its stack (backtrace()) into a buffer allocated by start().
+   * Samples are symbolized once stopped and written as collapsed stacks, one "root;...;leaf count" line per
+   * distinct stack, ready for flamegraph.pl or speedscope.
+   * Nothing runs while it is stopped: no timer, no handler.
+   * @note: function names of the executable need -rdynamic (ENABLE_EXPORTS in CMake), its frames are [module] otherwise.
+   */
+  class dprofiler {
+    public:
+        static constexpr std::size_t MAX_DEPTH = 48;
+        static constexpr std::size_t MAX_SAMPLES = 32768;
+
+    public:
+        dprofiler() = default;
+        dprofiler(const dprofiler&) = delete;
+        dprofiler& operator=(const dprofiler&) = delete;
+        ~dprofiler() { stop(); }
+
+        /**
+         * Start sampling, dropping the previous samples.
+         * @param hz: samples per second of CPU time, 99 avoids beating with periodic work
+         * @param samples: buffer size, samples past it are counted as dropped
+         * @return false if already running (in this or another instance) or on failure (logged)
+         */
+        bool start(int hz = 99, std::size_t samples = 8192) {
+          if(is_running() || s_active.load() != nullptr) return false;
+          hz = hz < 1 ? 1 : hz > 1000 ? 1000 : hz;
+          m_capacity = samples < 1 ? 1 : samples > MAX_SAMPLES ? MAX_SAMPLES : samples;
+          m_samples.reset(new sample[m_capacity]);
+          m_next.store(0, std::memory_order_relaxed);
+          // backtrace() loads libgcc on its first call, which must not happen in the signal handler.
+          void* frame;
+          backtrace(&frame, 1);
+          struct sigaction action{};
+          action.sa_sigaction = &on_signal;
+          action.sa_flags = SA_SIGINFO | SA_RESTART;
+          sigemptyset(&action.sa_mask);
+          sigset_t mask;
+          sigemptyset(&mask);
+          sigaddset(&mask, SIGPROF);
+          if(sigaction(SIGPROF, &action, nullptr) < 0 || pthread_sigmask(SIG_UNBLOCK, &mask, nullptr) != 0) {
+            dlog::error("Could not install the profiler's signal handler: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          s_active.store(this);
+          const long interval_us = 1000000L / hz;
+          itimerval timer{};
+          timer.it_interval.tv_sec = interval_us / 1000000;
+          timer.it_interval.tv_usec = interval_us % 1000000;
+          timer.it_value = timer.it_interval;
+          if(setitimer(ITIMER_PROF, &timer, nullptr) < 0) {
+            dlog::error("Could not start the profiler's timer: " + std::string(std::strerror(errno)));
+            s_active.store(nullptr);
+            return false;
+          }
+          m_hz = hz;
+          m_running = true;
+          return true;
+        }
+
+        /**
+         * Stop sampling, keeping the samples until the next start().
+         */
+        void stop() {
+          if(!m_running) return;
+          const itimerval off{};
+          setitimer(ITIMER_PROF, &off, nullptr);
+          // A handler seeing this instance has registered itself in s_in_flight first: wait for it to finish.
+          s_active.store(nullptr);
+          while(s_in_flight.load() != 0)
+            std::this_thread::yield();
+          m_running = false;
+        }
+
+        bool is_running() const noexcept { return m_running; }
+
+        /// Number of samples kept
+        std::size_t get_samples() const noexcept {
+          const std::size_t taken = m_next.load(std::memory_order_acquire);
+          return taken < m_capacity ? taken : m_capacity;
+        }
+
+        /// Number of samples lost to a full buffer
+        std::size_t get_dropped() const noexcept {
+          const std::size_t taken = m_next.load(std::memory_order_acquire);
+          return taken > m_capacity ? taken - m_capacity : 0;
+        }
+
+        int get_hz() const noexcept { return m_hz; }
+
+        /**
+         * Write the samples of the last run as collapsed stacks, call it once stopped.
+         * @return false on failure (logged)
+         */
+        bool write_folded(const std::string& path) const {
+          std::map<std::string, std::size_t> stacks;
+          std::unordered_map<void*, std::string> names;
+          const std::size_t count = m_running ? 0 : get_samples();
+          for(std::size_t i = 0; i < count; i++) {
+            const sample& s = m_samples[i];
+            std::string stack;
+            // Frame 0 is the signal handler, frame 1 the kernel's signal trampoline, the root is last.
+            for(std::size_t f = s.depth; f-- > 2;) {
+              auto it = names.find(s.frames[f]);
+              if(it == names.end()) it = names.emplace(s.frames[f], symbolize(s.frames[f])).first;
+              if(!stack.empty()) stack += ';';
+              stack += it->second;
+            }
+            if(!stack.empty()) stacks[stack]++;
+          }
+          std::ofstream out(path, std::ios::trunc);
+          for(const auto& stack : stacks)
+            out << stack.first << ' ' << stack.second << '\n';
+          out.close();
+          if(!out) {
+            dlog::error("Could not write profile " + path + ": " + std::string(std::strerror(errno)));
+            return false;
+          }
+          return true;
+        }
+
+    private:
+        struct sample {
+          std::size_t depth;
+          void* frames[MAX_DEPTH];
+        };
+
+        static void on_signal(int, siginfo_t*, void*) {
+          const int saved_errno = errno;
+          s_in_flight.fetch_add(1);
+          dprofiler* self = s_active.load();
+          if(self) {
+            const std::size_t index = self->m_next.fetch_add(1, std::memory_order_relaxed);
+            if(index < self->m_capacity) {
+              sample& s = self->m_samples[index];
+              const int depth = backtrace(s.frames, static_cast<int>(MAX_DEPTH));
+              s.depth = depth > 0 ? static_cast<std::size_t>(depth) : 0;
+            }
+          }
+          s_in_flight.fetch_sub(1);
+          errno = saved_errno;
+        }
+
+        /**
+         * Demangled function name, [module] when the symbol is not exported.
+         */
+        static std::string symbolize(void* address) {
+          // Return addresses point after the call, look the caller's instruction up.
+          void* inside = static_cast<char*>(address) - 1;
+          Dl_info info{};
+          std::string name;
+          if(dladdr(inside, &info) && info.dli_sname) {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            name = status == 0 && demangled ? demangled : info.dli_sname;
+            std::free(demangled);
+          } else if(info.dli_fname) {
+            // Per module only, instruction offsets would split the flame graph into one frame per sample.
+            const char* module = std::strrchr(info.dli_fname, '/');
+            name = "[" + std::string(module ? module + 1 : info.dli_fname) + "]";
+          } else {
+            name = "[unknown]";
+          }
+          // ';' separates frames in the collapsed format
+          for(char& c : name)
+            if(c == ';') c = ',';
+          return name;
+        }
+
+    private:
+        std::unique_ptr<sample[]> m_samples;
+        std::size_t m_capacity{0};
+        std::atomic<std::size_t> m_next{0};
+        int m_hz{0};
+        bool m_running{false};
+        static std::atomic<dprofiler*> s_active;  // profiler the signal handler records into
+        static std::atomic<int> s_in_flight;      // signal handlers running
+  };
+  std::atomic<dprofiler*> dprofiler::s_active{nullptr};
+  std::atomic<int> dprofiler::s_in_flight{0};
+} // !namespace daemonpp
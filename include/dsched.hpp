@@ -0,0 +1,204 @@
+#pragma once
+#include <unistd.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "dlog.hpp"
+#include "dconfig.hpp"
+
+namespace daemonpp {
+  /**
+   * Per thread scheduling settings: CPU affinity, scheduling policy and priority, nice level, timer slack and IO priority.
+   * Read from the daemon's config with a prefix ("loop_" for the daemon's thread, "worker_" for the pool threads):
+   *
+   *   loop_cpu_affinity=2-3          # CPU list
+   *   loop_sched_policy=fifo         # other, batch, idle, fifo or rr
+   *   loop_sched_priority=10         # 1..99 for fifo and rr
+   *   loop_nice=-5                   # -20..19
+   *   loop_timer_slack_ns=1          # timer expiration slack, default 50000
+   *   loop_ioprio=be/2               # rt/0..7, be/0..7 or idle
+   *
+   * @note: real time policies, negative nice levels and rt IO priority need CAP_SYS_NICE (AmbientCapabilities= in the .service file).
+   */
+  class dsched {
+    public:
+        struct settings {
+          bool has_affinity{false};
+          cpu_set_t affinity{};
+          bool has_policy{false};
+          int policy{SCHED_OTHER};
+          int priority{0};
+          bool has_nice{false};
+          int nice{0};
+          bool has_timer_slack{false};
+          unsigned long timer_slack_ns{0};
+          bool has_ioprio{false};
+          int ioprio{0};
+
+          /**
+           * These settings with the ones set in `other` replacing them.
+           */
+          settings overlay(const settings& other) const {
+            settings merged = *this;
+            if(other.has_affinity) { merged.has_affinity = true; merged.affinity = other.affinity; }
+            if(other.has_policy) { merged.has_policy = true; merged.policy = other.policy; merged.priority = other.priority; }
+            if(other.has_nice) { merged.has_nice = true; merged.nice = other.nice; }
+            if(other.has_timer_slack) { merged.has_timer_slack = true; merged.timer_slack_ns = other.timer_slack_ns; }
+            if(other.has_ioprio) { merged.has_ioprio = true; merged.ioprio = other.ioprio; }
+            return merged;
+          }
+        };
+
+        /**
+         * Settings of the calling thread.
+         */
+        static settings current() {
+          settings s;
+          s.has_affinity = sched_getaffinity(0, sizeof(s.affinity), &s.affinity) == 0;
+          sched_param param{};
+          s.policy = sched_getscheduler(0);
+          s.has_policy = s.policy >= 0 && sched_getparam(0, &param) == 0;
+          s.policy &= ~SCHED_RESET_ON_FORK;
+          s.priority = param.sched_priority;
+          errno = 0;
+          s.nice = getpriority(PRIO_PROCESS, static_cast<id_t>(thread_id()));
+          s.has_nice = errno == 0;
+          const int slack = prctl(PR_GET_TIMERSLACK);
+          s.has_timer_slack = slack >= 0;
+          s.timer_slack_ns = static_cast<unsigned long>(slack);
+          s.ioprio = static_cast<int>(syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0));
+          s.has_ioprio = s.ioprio >= 0;
+          return s;
+        }
+
+        /**
+         * Parse the settings named prefix + key from the config, only the keys present are set.
+         */
+        static settings from_config(const dconfig& cfg, const std::string& prefix) {
+          settings s;
+          const std::string affinity = cfg.get(prefix + "cpu_affinity");
+          if(!affinity.empty()) {
+            CPU_ZERO(&s.affinity);
+            for(int cpu : parse_cpu_list(affinity))
+              if(cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &s.affinity);
+            s.has_affinity = CPU_COUNT(&s.affinity) > 0;
+            if(!s.has_affinity) dlog::error("Invalid " + prefix + "cpu_affinity '" + affinity + "'.");
+          }
+          const std::string policy = cfg.get(prefix + "sched_policy");
+          if(!policy.empty()) {
+            s.has_policy = true;
+            if(policy == "other") s.policy = SCHED_OTHER;
+            else if(policy == "batch") s.policy = SCHED_BATCH;
+            else if(policy == "idle") s.policy = SCHED_IDLE;
+            else if(policy == "fifo") s.policy = SCHED_FIFO;
+            else if(policy == "rr") s.policy = SCHED_RR;
+            else {
+              s.has_policy = false;
+              dlog::error("Invalid " + prefix + "sched_policy '" + policy + "', expected other, batch, idle, fifo or rr.");
+            }
+            const std::string priority = cfg.get(prefix + "sched_priority");
+            s.priority = s.policy == SCHED_FIFO || s.policy == SCHED_RR ? (priority.empty() ? 1 : std::atoi(priority.c_str())) : 0;
+          }
+          const std::string nice = cfg.get(prefix + "nice");
+          if(!nice.empty()) {
+            s.has_nice = true;
+            s.nice = std::atoi(nice.c_str());
+          }
+          const std::string slack = cfg.get(prefix + "timer_slack_ns");
+          if(!slack.empty()) {
+            s.has_timer_slack = true;
+            s.timer_slack_ns = std::strtoul(slack.c_str(), nullptr, 10);
+          }
+          const std::string ioprio = cfg.get(prefix + "ioprio");
+          if(!ioprio.empty()) {
+            s.has_ioprio = true;
+            const int level = ioprio.size() > 3 ? std::atoi(ioprio.c_str() + 3) : 0;
+            if(ioprio.compare(0, 3, "rt/") == 0) s.ioprio = make_ioprio(IOPRIO_CLASS_RT, level);
+            else if(ioprio.compare(0, 3, "be/") == 0) s.ioprio = make_ioprio(IOPRIO_CLASS_BE, level);
+            else if(ioprio == "idle") s.ioprio = make_ioprio(IOPRIO_CLASS_IDLE, 0);
+            else {
+              s.has_ioprio = false;
+              dlog::error("Invalid " + prefix + "ioprio '" + ioprio + "', expected rt/0..7, be/0..7 or idle.");
+            }
+          }
+          return s;
+        }
+
+        /**
+         * Apply the settings to the calling thread, only touching what differs from its current settings.
+         * @return false if a setting could not be applied (logged)
+         */
+        static bool apply(const settings& s) {
+          const settings now = current();
+          bool ok = true;
+          if(s.has_affinity && !(now.has_affinity && CPU_EQUAL(&s.affinity, &now.affinity)) &&
+             sched_setaffinity(0, sizeof(s.affinity), &s.affinity) < 0) {
+            dlog::error("Could not set CPU affinity: " + std::string(std::strerror(errno)));
+            ok = false;
+          }
+          if(s.has_policy && !(now.has_policy && now.policy == s.policy && now.priority == s.priority)) {
+            sched_param param{};
+            param.sched_priority = s.priority;
+            if(sched_setscheduler(0, s.policy, &param) < 0) {
+              dlog::error("Could not set scheduling policy " + std::to_string(s.policy) + " priority " +
+                          std::to_string(s.priority) + ": " + std::string(std::strerror(errno)));
+              ok = false;
+            }
+          }
+          if(s.has_nice && !(now.has_nice && now.nice == s.nice) &&
+             setpriority(PRIO_PROCESS, static_cast<id_t>(thread_id()), s.nice) < 0) {
+            dlog::error("Could not set nice level " + std::to_string(s.nice) + ": " + std::string(std::strerror(errno)));
+            ok = false;
+          }
+          if(s.has_timer_slack && !(now.has_timer_slack && now.timer_slack_ns == s.timer_slack_ns) &&
+             prctl(PR_SET_TIMERSLACK, s.timer_slack_ns) < 0) {
+            dlog::error("Could not set timer slack: " + std::string(std::strerror(errno)));
+            ok = false;
+          }
+          if(s.has_ioprio && !(now.has_ioprio && now.ioprio == s.ioprio) &&
+             syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, s.ioprio) < 0) {
+            dlog::error("Could not set IO priority: " + std::string(std::strerror(errno)));
+            ok = false;
+          }
+          return ok;
+        }
+
+        /**
+         * Parse a kernel CPU list, e.g "0-3,8,10-11".
+         */
+        static std::vector<int> parse_cpu_list(const std::string& list) {
+          std::vector<int> cpus;
+          std::size_t begin = 0;
+          while(begin < list.size()) {
+            std::size_t end = list.find(',', begin);
+            if(end == std::string::npos) end = list.size();
+            const std::string range = list.substr(begin, end - begin);
+            const std::size_t dash = range.find('-');
+            const int first = std::atoi(range.c_str());
+            const int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+            for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+            begin = end + 1;
+          }
+          return cpus;
+        }
+
+    private:
+        // <linux/ioprio.h> is missing from older kernel headers
+        static constexpr int IOPRIO_WHO_PROCESS = 1;
+        static constexpr int IOPRIO_CLASS_RT = 1;
+        static constexpr int IOPRIO_CLASS_BE = 2;
+        static constexpr int IOPRIO_CLASS_IDLE = 3;
+
+        static int make_ioprio(int io_class, int level) {
+          return (io_class << 13) | (level & 7);
+        }
+
+        static pid_t thread_id() { return static_cast<pid_t>(syscall(SYS_gettid)); }
+  };
+} // !namespace daemonpp
@@ -0,0 +1,371 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "dlog.hpp"
+#include "dloop.hpp"
+
+namespace daemonpp {
+  /**
+   * Named periodic and one shot tasks scheduler.
+   * Backed by a hierarchical timer wheel (256 slots, then 4 levels of 64 slots, ~49 days range at 1ms resolution)
+   * with O(1) insert and cancel, driven by a single timerfd of the event loop armed to the next due slot.
+   * @note: not thread safe, use it from the loop's thread (post() to it from other threads).
+   */
+  class dscheduler {
+    public:
+        using callback = std::function<void()>;
+        using clock = std::chrono::steady_clock;
+
+        struct task_info {
+          std::string name;
+          clock::duration period; ///< zero for a one shot task
+          clock::duration due_in; ///< time left before the next call (when paused, once resumed)
+          bool paused;
+        };
+
+    public:
+        /**
+         * @param loop: event loop to run the tasks on
+         * @param resolution: duration of one wheel tick, task periods are rounded up to it
+         */
+        explicit dscheduler(dloop& loop, const clock::duration& resolution = std::chrono::milliseconds(1)) :
+        m_loop(loop), m_resolution(resolution), m_epoch(clock::now())
+        {
+          m_timer = m_loop.add_timer(std::chrono::nanoseconds::zero(), [this]() { on_timer(); });
+        }
+
+        dscheduler(const dscheduler&) = delete;
+        dscheduler& operator=(const dscheduler&) = delete;
+
+        ~dscheduler() {
+          m_loop.remove_timer(m_timer);
+        }
+
+        /**
+         * Add a task called every period, first call after one period.
+         * Periodic tasks keep their phase: a late run does not shift the following ones.
+         * Adding a task with an existing name replaces it.
+         */
+        template<typename Rep, typename Period>
+        void add_task(const std::string& name, const std::chrono::duration<Rep, Period>& period, callback fn) {
+          add(name, to_ticks(period), to_ticks(period), std::move(fn));
+        }
+
+        /**
+         * Add a task called once after delay, then removed.
+         * Adding a task with an existing name replaces it.
+         */
+        template<typename Rep, typename Period>
+        void add_oneshot_task(const std::string& name, const std::chrono::duration<Rep, Period>& delay, callback fn) {
+          add(name, to_ticks(delay), 0, std::move(fn));
+        }
+
+        /**
+         * Change the period (or delay of a one shot task), the next call happens after the new period from now.
+         * @return false if there is no task with this name
+         */
+        template<typename Rep, typename Period>
+        bool reschedule_task(const std::string& name, const std::chrono::duration<Rep, Period>& period) {
+          auto it = m_tasks.find(name);
+          if(it == m_tasks.end()) return false;
+          node* n = it->second.get();
+          unlink(n);
+          n->paused = false;
+          const std::uint64_t ticks = to_ticks(period);
+          if(n->period) n->period = ticks;
+          n->expiry = now_ticks() + ticks;
+          insert(n);
+          rearm();
+          return true;
+        }
+
+        /**
+         * Cancel and remove a task, safe to call from any task callback including its own.
+         * @return false if there is no task with this name
+         */
+        bool cancel_task(const std::string& name) {
+          auto it = m_tasks.find(name);
+          if(it == m_tasks.end()) return false;
+          unlink(it->second.get());
+          m_tasks.erase(it);
+          rearm();
+          return true;
+        }
+
+        /**
+         * Stop calling a task until resume_task(), it keeps its name and period.
+         * @return false if there is no task with this name or it is already paused
+         */
+        bool pause_task(const std::string& name) {
+          auto it = m_tasks.find(name);
+          if(it == m_tasks.end() || it->second->paused) return false;
+          node* n = it->second.get();
+          unlink(n);
+          const std::uint64_t now = std::max(m_now, now_ticks());
+          n->remaining = n->expiry > now ? n->expiry - now : 0;
+          n->paused = true;
+          rearm();
+          return true;
+        }
+
+        /**
+         * Resume a paused task, its next call happens after the time it had left when paused.
+         * @return false if there is no task with this name or it is not paused
+         */
+        bool resume_task(const std::string& name) {
+          auto it = m_tasks.find(name);
+          if(it == m_tasks.end() || !it->second->paused) return false;
+          node* n = it->second.get();
+          n->paused = false;
+          if(!next_expiry()) m_now = std::max(m_now, now_ticks());
+          n->expiry = now_ticks() + std::max<std::uint64_t>(n->remaining, 1);
+          insert(n);
+          rearm();
+          return true;
+        }
+
+        /**
+         * Tasks sorted by name.
+         */
+        std::vector<task_info> get_tasks() const {
+          std::vector<task_info> tasks;
+          const std::uint64_t now = std::max(m_now, now_ticks());
+          for(const auto& entry : m_tasks) {
+            const node& n = *entry.second;
+            const std::uint64_t left = n.paused ? n.remaining : n.expiry > now ? n.expiry - now : 0;
+            tasks.push_back(task_info{n.name, m_resolution * static_cast<std::int64_t>(n.period), m_resolution * static_cast<std::int64_t>(left), n.paused});
+          }
+          std::sort(tasks.begin(), tasks.end(), [](const task_info& a, const task_info& b) { return a.name < b.name; });
+          return tasks;
+        }
+
+        bool has_task(const std::string& name) const { return m_tasks.count(name) != 0; }
+        std::size_t get_task_count() const noexcept { return m_tasks.size(); }
+        const clock::duration& get_resolution() const noexcept { return m_resolution; }
+
+    private:
+        static constexpr std::uint32_t LEVELS = 5;
+        static constexpr std::uint32_t ROOT_BITS = 8;  // level 0: 256 slots of 1 tick
+        static constexpr std::uint32_t LEVEL_BITS = 6; // levels 1..4: 64 slots of 2^(8+6*(L-1)) ticks
+        static constexpr std::uint64_t MAX_DELTA = (std::uint64_t(1) << (ROOT_BITS + LEVEL_BITS * (LEVELS - 1))) - 1;
+        static constexpr std::uint8_t EXPIRED = 0xff;
+
+        struct node {
+          std::string name;
+          std::shared_ptr<callback> fn; // shared so a task cancelling itself keeps its callback alive while running
+          std::uint64_t expiry{0};      // absolute tick
+          std::uint64_t period{0};      // ticks, 0 for one shot tasks
+          std::uint64_t remaining{0};   // ticks left when paused
+          node* prev{nullptr};
+          node* next{nullptr};
+          std::uint8_t level{EXPIRED};
+          std::uint16_t slot{0};
+          bool linked{false};
+          bool paused{false};
+        };
+
+        static std::uint32_t shift(std::uint32_t level) noexcept {
+          return level == 0 ? 0 : ROOT_BITS + LEVEL_BITS * (level - 1);
+        }
+        static std::uint32_t slots(std::uint32_t level) noexcept {
+          return level == 0 ? (1u << ROOT_BITS) : (1u << LEVEL_BITS);
+        }
+
+        void add(const std::string& name, std::uint64_t delay, std::uint64_t period, callback fn) {
+          std::unique_ptr<node>& n = m_tasks[name];
+          if(n) unlink(n.get());
+          else n.reset(new node());
+          n->name = name;
+          n->fn = std::make_shared<callback>(std::move(fn));
+          n->period = period;
+          n->paused = false;
+          // Nothing to process in between, catch the idle wheel up with the clock instead of stepping through it later.
+          if(!next_expiry()) m_now = std::max(m_now, now_ticks());
+          n->expiry = now_ticks() + delay;
+          insert(n.get());
+          rearm();
+        }
+
+        void insert(node* n) {
+          // The wheel may lag behind the clock until the next wake up, place relative to the wheel's time.
+          // A zero delta only happens when cascading into the root slot about to be fired.
+          if(n->expiry < m_now) n->expiry = m_now;
+          const std::uint64_t delta = n->expiry - m_now;
+          std::uint32_t level = 0;
+          std::uint64_t at = n->expiry;
+          if(delta >= slots(0)) {
+            if(delta > MAX_DELTA) at = m_now + MAX_DELTA; // re-cascaded until in range
+            const std::uint64_t clamped = at - m_now;
+            level = 1;
+            while(level < LEVELS - 1 && clamped >= (std::uint64_t(1) << (shift(level) + LEVEL_BITS)))
+              level++;
+          }
+          const std::uint16_t slot = static_cast<std::uint16_t>((at >> shift(level)) & (slots(level) - 1));
+          link(n, level, slot);
+        }
+
+        void link(node* n, std::uint8_t level, std::uint16_t slot) {
+          node*& head = level == EXPIRED ? m_expired : m_slots[level][slot];
+          n->level = level;
+          n->slot = slot;
+          n->prev = nullptr;
+          n->next = head;
+          if(head) head->prev = n;
+          head = n;
+          n->linked = true;
+          if(level != EXPIRED)
+            m_bitmap[level][slot / 64] |= std::uint64_t(1) << (slot % 64);
+        }
+
+        void unlink(node* n) {
+          if(!n->linked) return;
+          node*& head = n->level == EXPIRED ? m_expired : m_slots[n->level][n->slot];
+          if(n->prev) n->prev->next = n->next;
+          else head = n->next;
+          if(n->next) n->next->prev = n->prev;
+          n->prev = n->next = nullptr;
+          n->linked = false;
+          if(n->level != EXPIRED && !head)
+            m_bitmap[n->level][n->slot / 64] &= ~(std::uint64_t(1) << (n->slot % 64));
+        }
+
+        /**
+         * Distance (1..slots) from slot `from` to the next non empty slot of a level, circularly.
+         * @return 0 if the level is empty
+         */
+        std::uint32_t next_slot_distance(std::uint32_t level, std::uint32_t from) const noexcept {
+          const std::uint32_t count = slots(level);
+          for(std::uint32_t distance = 1; distance <= count; ) {
+            const std::uint32_t index = (from + distance) % count;
+            const std::uint64_t bits = m_bitmap[level][index / 64] >> (index % 64);
+            if(bits)
+              return distance + static_cast<std::uint32_t>(__builtin_ctzll(bits));
+            distance += 64 - index % 64; // jump to the start of the next bitmap word
+          }
+          return 0;
+        }
+
+        /**
+         * Absolute tick at which something must be processed next, 0 if the wheel is empty.
+         */
+        std::uint64_t next_expiry() const noexcept {
+          std::uint64_t next = 0;
+          for(std::uint32_t level = 0; level < LEVELS; level++) {
+            const std::uint32_t current = static_cast<std::uint32_t>((m_now >> shift(level)) & (slots(level) - 1));
+            const std::uint32_t distance = next_slot_distance(level, current);
+            if(!distance) continue;
+            const std::uint64_t at = ((m_now >> shift(level)) + distance) << shift(level);
+            if(!next || at < next) next = at;
+          }
+          return next;
+        }
+
+        void on_timer() {
+          m_armed = 0;
+          advance(now_ticks());
+          rearm();
+        }
+
+        /**
+         * Move the wheel's time forward to `target`, cascading and firing slots on the way.
+         */
+        void advance(std::uint64_t target) {
+          while(m_now < target) {
+            // Jump straight to the next tick with something to fire or cascade, the ticks in between are no-ops.
+            const std::uint64_t next = next_expiry();
+            if(!next || next > target) {
+              m_now = target;
+              break;
+            }
+            m_now = next;
+            if((m_now & (slots(0) - 1)) == 0) {
+              for(std::uint32_t level = 1; level < LEVELS; level++) {
+                const std::uint32_t index = static_cast<std::uint32_t>((m_now >> shift(level)) & (slots(level) - 1));
+                cascade(level, index);
+                if(index != 0) break;
+              }
+            }
+            fire(static_cast<std::uint16_t>(m_now & (slots(0) - 1)), target);
+          }
+        }
+
+        void cascade(std::uint32_t level, std::uint32_t index) {
+          node* n = m_slots[level][index];
+          m_slots[level][index] = nullptr;
+          m_bitmap[level][index / 64] &= ~(std::uint64_t(1) << (index % 64));
+          while(n) {
+            node* next = n->next;
+            n->linked = false;
+            insert(n);
+            n = next;
+          }
+        }
+
+        /**
+         * Call the tasks of a root slot, the wheel's time being at that slot.
+         * @param target: the real time being advanced to, later than m_now after a stall
+         */
+        void fire(std::uint16_t slot, std::uint64_t target) {
+          if(!m_slots[0][slot]) return;
+          // Move the due tasks to the expired list first so callbacks can cancel/add tasks freely.
+          while(node* n = m_slots[0][slot]) {
+            unlink(n);
+            link(n, EXPIRED, 0);
+          }
+          while(node* n = m_expired) {
+            unlink(n);
+            std::shared_ptr<callback> fn = n->fn;
+            if(n->period) {
+              n->expiry += n->period;
+              if(n->expiry <= target) // fell behind, skip the missed runs and stay in phase
+                n->expiry += ((target - n->expiry) / n->period + 1) * n->period;
+              insert(n);
+            } else {
+              m_tasks.erase(n->name);
+            }
+            (*fn)();
+          }
+        }
+
+        void rearm() {
+          // Only touch the timerfd when the next wake up changes, adding tasks due later than it costs no syscall.
+          const std::uint64_t next = next_expiry();
+          if(next == m_armed) return;
+          m_armed = next;
+          if(!next) {
+            m_loop.cancel_timer(m_timer);
+            return;
+          }
+          m_loop.set_timer_at(m_timer, m_epoch + m_resolution * static_cast<std::int64_t>(next));
+        }
+
+        std::uint64_t now_ticks() const {
+          return static_cast<std::uint64_t>((clock::now() - m_epoch) / m_resolution);
+        }
+
+        template<typename Rep, typename Period>
+        std::uint64_t to_ticks(const std::chrono::duration<Rep, Period>& d) const {
+          const auto ns = std::chrono::duration_cast<clock::duration>(d);
+          const auto ticks = (ns + m_resolution - clock::duration(1)) / m_resolution; // round up
+          return ticks < 1 ? 1 : static_cast<std::uint64_t>(ticks);
+        }
+
+    private:
+        dloop& m_loop;
+        clock::duration m_resolution;
+        clock::time_point m_epoch;
+        int m_timer{-1};
+        std::uint64_t m_now{0};
+        std::uint64_t m_armed{0}; // tick the timerfd is armed for, 0 when disarmed
+        node* m_slots[LEVELS][1u << ROOT_BITS]{};
+        std::uint64_t m_bitmap[LEVELS][(1u << ROOT_BITS) / 64]{};
+        node* m_expired{nullptr};
+        std::unordered_map<std::string, std::unique_ptr<node>> m_tasks;
+    };
+} // !namespace daemonpp
@@ -0,0 +1,313 @@
+#pragma once
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "dlog.hpp"
+#include "dmetrics.hpp"
+
+namespace daemonpp {
+  /**
+   * Stats segment: the daemon's status, live tick counters and metrics published in a fixed layout file mapped
+   * in shared memory (/dev/shm/<name>.stats), so tools read them with plain memory loads, without a syscall
+   * round trip nor waking the daemon up.
+   *
+   * The segment is guarded by a sequence lock: the (single) writer makes the sequence odd while it writes, readers
+   * copy the segment and retry when the sequence was odd or changed meanwhile (see dstats::reader).
+   */
+  class dstats {
+    public:
+        static constexpr std::uint32_t MAGIC = 0x54535044; // "DPST"
+        static constexpr std::uint32_t VERSION = 1;
+        static constexpr std::size_t MAX_ENTRIES = 256;
+        static constexpr std::size_t NAME_SIZE = 128;
+
+        /// Tick counters, rewritten after every on_update()
+        struct tick_info {
+          std::uint64_t ticks{0};
+          std::uint64_t overruns{0};
+          std::uint64_t missed{0};
+          std::uint64_t period_ns{0};        ///< on_update() period, stretched under pressure
+          std::uint64_t last_lateness_ns{0};
+          std::uint64_t max_lateness_ns{0};
+          std::uint64_t last_update_ns{0};   ///< last on_update() run time
+          std::uint32_t stretch{1};
+          std::uint32_t flags{0};            ///< SHEDDING
+        };
+        static constexpr std::uint32_t SHEDDING = 1;
+
+        /// One metric of the registry
+        struct entry {
+          char name[NAME_SIZE];   ///< truncated series name
+          std::uint32_t kind;     ///< dmetrics::type
+          std::uint32_t reserved;
+          double value;           ///< counter or gauge value, histogram sum (scaled)
+          std::uint64_t count;    ///< histogram sample count
+          double p50;             ///< histogram quantiles over the last publish interval (scaled), 0 without samples
+          double p90;
+          double p99;
+          double max;
+        };
+
+        /// Segment layout
+        struct layout {
+          std::uint32_t magic;
+          std::uint32_t version;
+          std::atomic<std::uint32_t> sequence; // odd while being written
+          std::uint32_t pid;
+          std::int64_t updated_ns;             // CLOCK_REALTIME of the last write
+          std::int64_t metrics_updated_ns;     // CLOCK_REALTIME of the last publish_metrics()
+          char status[NAME_SIZE];
+          tick_info tick;
+          std::uint32_t entry_count;
+          std::uint32_t dropped;               // metrics left out, past MAX_ENTRIES
+          entry entries[MAX_ENTRIES];
+        };
+
+        /// Consistent copy of a segment
+        struct snapshot {
+          std::uint32_t pid{0};
+          std::int64_t updated_ns{0};
+          std::int64_t metrics_updated_ns{0};
+          std::string status;
+          tick_info tick{};
+          std::uint32_t dropped{0};
+          std::vector<entry> entries;
+        };
+
+        /**
+         * Read only mapping of a segment, for tools.
+         */
+        class reader {
+          public:
+              reader() = default;
+              reader(const reader&) = delete;
+              reader& operator=(const reader&) = delete;
+              ~reader() { if(m_segment) munmap(const_cast<layout*>(m_segment), sizeof(layout)); }
+
+              /**
+               * @return false if path is not a stats segment (errno set, or EPROTO for a foreign layout)
+               */
+              bool open(const std::string& path) {
+                const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if(fd < 0) return false;
+                struct stat st{};
+                if(fstat(fd, &st) < 0 || static_cast<std::size_t>(st.st_size) < sizeof(layout)) {
+                  ::close(fd);
+                  errno = EPROTO;
+                  return false;
+                }
+                void* data = mmap(nullptr, sizeof(layout), PROT_READ, MAP_SHARED, fd, 0);
+                ::close(fd);
+                if(data == MAP_FAILED) return false;
+                m_segment = static_cast<const layout*>(data);
+                if(m_segment->magic != MAGIC || m_segment->version != VERSION) {
+                  munmap(data, sizeof(layout));
+                  m_segment = nullptr;
+                  errno = EPROTO;
+                  return false;
+                }
+                return true;
+              }
+
+              /**
+               * Copy the segment, retrying while the daemon writes it.
+               * @return false if no consistent copy could be made within `attempts`
+               */
+              bool read(snapshot& snap, int attempts = 1000) const {
+                if(!m_segment) return false;
+                for(int i = 0; i < attempts; i++) {
+                  const std::uint32_t before = m_segment->sequence.load(std::memory_order_acquire);
+                  if(before & 1) continue;
+                  char status[NAME_SIZE];
+                  std::memcpy(status, m_segment->status, sizeof(status));
+                  snap.pid = m_segment->pid;
+                  snap.updated_ns = m_segment->updated_ns;
+                  snap.metrics_updated_ns = m_segment->metrics_updated_ns;
+                  std::memcpy(&snap.tick, &m_segment->tick, sizeof(tick_info));
+                  snap.dropped = m_segment->dropped;
+                  const std::size_t count = m_segment->entry_count < MAX_ENTRIES ? m_segment->entry_count : MAX_ENTRIES;
+                  snap.entries.resize(count);
+                  if(count > 0) std::memcpy(snap.entries.data(), m_segment->entries, count * sizeof(entry));
+                  std::atomic_thread_fence(std::memory_order_acquire);
+                  if(m_segment->sequence.load(std::memory_order_relaxed) != before) continue;
+                  status[NAME_SIZE - 1] = '\0';
+                  snap.status = status;
+                  return true;
+                }
+                return false;
+              }
+
+          private:
+              const layout* m_segment{nullptr};
+        };
+
+    public:
+        dstats() = default;
+        dstats(const dstats&) = delete;
+        dstats& operator=(const dstats&) = delete;
+        ~dstats() { close(); }
+
+        /**
+         * Create a fresh segment, readable by every user, and rename it over path: a process still publishing
+         * at path (the old one during a hot upgrade) keeps writing its own segment, never ours.
+         * @return false on failure (logged)
+         */
+        bool open(const std::string& path) {
+          close();
+          const std::string fresh = path + "." + std::to_string(getpid());
+          const int fd = ::open(fresh.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+          struct stat st{};
+          if(fd < 0 || ftruncate(fd, sizeof(layout)) < 0 || fstat(fd, &st) < 0) {
+            dlog::error("Could not create stats segment " + fresh + ": " + std::string(std::strerror(errno)));
+            if(fd >= 0) {
+              ::close(fd);
+              ::unlink(fresh.c_str());
+            }
+            return false;
+          }
+          void* data = mmap(nullptr, sizeof(layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+          ::close(fd);
+          if(data == MAP_FAILED) {
+            dlog::error("Could not map stats segment " + fresh + ": " + std::string(std::strerror(errno)));
+            ::unlink(fresh.c_str());
+            return false;
+          }
+          m_segment = static_cast<layout*>(data);
+          begin_write();
+          m_segment->magic = MAGIC;
+          m_segment->version = VERSION;
+          m_segment->pid = static_cast<std::uint32_t>(getpid());
+          m_segment->entry_count = 0;
+          m_segment->dropped = 0;
+          end_write();
+          // Readers opening path only ever see an initialized segment.
+          if(::rename(fresh.c_str(), path.c_str()) < 0) {
+            dlog::error("Could not publish stats segment " + path + ": " + std::string(std::strerror(errno)));
+            munmap(m_segment, sizeof(layout));
+            m_segment = nullptr;
+            ::unlink(fresh.c_str());
+            return false;
+          }
+          m_path = path;
+          m_device = st.st_dev;
+          m_inode = st.st_ino;
+          return true;
+        }
+
+        /**
+         * Unmap the segment and remove it, unless path was taken over by another process' segment since.
+         */
+        void close() {
+          if(!m_segment) return;
+          munmap(m_segment, sizeof(layout));
+          struct stat st{};
+          if(::stat(m_path.c_str(), &st) == 0 && st.st_dev == m_device && st.st_ino == m_inode)
+            ::unlink(m_path.c_str());
+          m_segment = nullptr;
+          m_previous.clear();
+        }
+
+        bool is_open() const noexcept { return m_segment != nullptr; }
+
+        void publish_status(const std::string& status) {
+          if(!m_segment) return;
+          begin_write();
+          copy_name(m_segment->status, status);
+          end_write();
+        }
+
+        void publish_tick(const tick_info& tick) noexcept {
+          if(!m_segment) return;
+          begin_write();
+          m_segment->tick = tick;
+          end_write();
+        }
+
+        /**
+         * Publish the samples (dmetrics::collect()), histograms with their quantiles since the previous call.
+         */
+        void publish_metrics(const std::vector<dmetrics::sample>& samples) {
+          if(!m_segment) return;
+          const std::size_t count = samples.size() < MAX_ENTRIES ? samples.size() : MAX_ENTRIES;
+          std::vector<entry> entries(count);
+          for(std::size_t i = 0; i < count; i++) {
+            const dmetrics::sample& s = samples[i];
+            entry& e = entries[i];
+            std::memset(&e, 0, sizeof(e));
+            copy_name(e.name, s.name);
+            e.kind = static_cast<std::uint32_t>(s.kind);
+            if(s.kind != dmetrics::type::histogram) {
+              e.value = s.value;
+              continue;
+            }
+            e.value = static_cast<double>(s.hist.sum) * s.scale;
+            e.count = s.hist.count;
+            // Quantiles of the samples recorded since the previous publish: live latency, not since start.
+            dmetrics::histogram::snapshot recent = s.hist;
+            std::vector<std::uint64_t>& previous = m_previous[s.name];
+            previous.resize(recent.buckets.size(), 0);
+            recent.count = 0;
+            for(std::size_t b = 0; b < recent.buckets.size(); b++) {
+              const std::uint64_t current = recent.buckets[b];
+              recent.buckets[b] = current >= previous[b] ? current - previous[b] : current;
+              recent.count += recent.buckets[b];
+              previous[b] = current;
+            }
+            if(recent.count == 0) continue;
+            e.p50 = static_cast<double>(recent.quantile(0.5)) * s.scale;
+            e.p90 = static_cast<double>(recent.quantile(0.9)) * s.scale;
+            e.p99 = static_cast<double>(recent.quantile(0.99)) * s.scale;
+            e.max = static_cast<double>(recent.quantile(1.0)) * s.scale;
+          }
+          begin_write();
+          if(count > 0) std::memcpy(m_segment->entries, entries.data(), count * sizeof(entry));
+          m_segment->entry_count = static_cast<std::uint32_t>(count);
+          m_segment->dropped = static_cast<std::uint32_t>(samples.size() - count);
+          m_segment->metrics_updated_ns = now_ns();
+          end_write();
+        }
+
+        /**
+         * Segment path of a daemon, e.g /dev/shm/my_daemon.stats.
+         */
+        static std::string path_of(const std::string& name) { return "/dev/shm/" + name + ".stats"; }
+
+    private:
+        void begin_write() noexcept {
+          m_segment->sequence.store(m_segment->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        void end_write() noexcept {
+          m_segment->updated_ns = now_ns();
+          m_segment->sequence.store(m_segment->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        static std::int64_t now_ns() noexcept {
+          return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        static void copy_name(char (&to)[NAME_SIZE], const std::string& from) noexcept {
+          const std::size_t size = std::min(from.size(), NAME_SIZE - 1);
+          std::memcpy(to, from.data(), size);
+          to[size] = '\0';
+        }
+
+    private:
+        layout* m_segment{nullptr};
+        std::string m_path;
+        dev_t m_device{0};  // our segment file, see close()
+        ino_t m_inode{0};
+        std::map<std::string, std::vector<std::uint64_t>> m_previous; // histogram buckets at the previous publish
+  };
+} // !namespace daemonpp
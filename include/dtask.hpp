@@ -0,0 +1,285 @@
+#pragma once
+#if __cplusplus < 202002L
+#error "dtask.hpp requires C++20 coroutines, set cxx_std_20 in your CMakeLists.txt target_compile_features"
+#endif
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include "dlog.hpp"
+#include "dloop.hpp"
+#include "dscheduler.hpp"
+
+namespace daemonpp {
+  template<typename T = void>
+  class task;
+
+  namespace detail {
+    struct task_promise_base {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+        bool started{false};
+        bool detached{false};
+
+        struct final_awaiter {
+          bool await_ready() const noexcept { return false; }
+
+          template<typename Promise>
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> coroutine) noexcept {
+            task_promise_base& promise = coroutine.promise();
+            if(promise.detached) {
+              // Nobody will join a spawned task, report its failure and free the frame.
+              if(promise.exception) {
+                try { std::rethrow_exception(promise.exception); }
+                catch(const std::exception& e) { dlog::error(std::string("Detached task failed: ") + e.what()); }
+                catch(...) { dlog::error("Detached task failed with an unknown exception."); }
+              }
+              coroutine.destroy();
+              return std::noop_coroutine();
+            }
+            // Resume whoever awaits us (symmetric transfer, no stack growth on long await chains).
+            if(promise.continuation) return promise.continuation;
+            return std::noop_coroutine();
+          }
+
+          void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        final_awaiter final_suspend() const noexcept { return {}; }
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    template<typename T>
+    struct task_promise : task_promise_base {
+        std::optional<T> value;
+
+        task<T> get_return_object() noexcept;
+
+        template<typename U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+        T result() {
+          if(exception) std::rethrow_exception(exception);
+          return std::move(*value);
+        }
+    };
+
+    template<>
+    struct task_promise<void> : task_promise_base {
+        task<void> get_return_object() noexcept;
+
+        void return_void() const noexcept {}
+
+        void result() const {
+          if(exception) std::rethrow_exception(exception);
+        }
+    };
+  } // !namespace detail
+
+  /**
+   * Lazy coroutine task running on the daemon's thread.
+   * A task starts when it is awaited (co_await t), started (t.start()) or spawned (spawn(t)),
+   * and suspends on awaitables such as sleep_for(), readable() and writable() instead of blocking the daemon,
+   * which lets one thread interleave thousands of in flight operations.
+   *
+   *   task<std::size_t> read_some(dloop& loop, int fd, char* buf, std::size_t size) {
+   *     co_await readable(loop, fd);
+   *     co_return ::read(fd, buf, size);
+   *   }
+   *
+   * @note: destroying a suspended task cancels its pending sleep or fd wait, whoever awaits it is never resumed.
+   */
+  template<typename T>
+  class task {
+    public:
+        using promise_type = detail::task_promise<T>;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+    public:
+        task() noexcept = default;
+        explicit task(handle_type coroutine) noexcept : m_coroutine(coroutine) {}
+        task(task&& other) noexcept : m_coroutine(std::exchange(other.m_coroutine, {})) {}
+        task& operator=(task&& other) noexcept {
+          if(this != &other) {
+            if(m_coroutine) m_coroutine.destroy();
+            m_coroutine = std::exchange(other.m_coroutine, {});
+          }
+          return *this;
+        }
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+
+        ~task() {
+          if(m_coroutine) m_coroutine.destroy();
+        }
+
+        /**
+         * Start running the task now without waiting for it, join it later with co_await.
+         */
+        void start() {
+          if(m_coroutine && !m_coroutine.promise().started) {
+            m_coroutine.promise().started = true;
+            m_coroutine.resume();
+          }
+        }
+
+        /**
+         * Start the task (if not started yet) and let it free itself when done.
+         * Exceptions escaping a detached task are logged with dlog::error.
+         */
+        void detach() {
+          handle_type coroutine = std::exchange(m_coroutine, {});
+          if(!coroutine) return;
+          if(coroutine.done()) {
+            coroutine.destroy();
+            return;
+          }
+          coroutine.promise().detached = true;
+          if(!coroutine.promise().started) {
+            coroutine.promise().started = true;
+            coroutine.resume();
+          }
+        }
+
+        bool is_done() const noexcept { return !m_coroutine || m_coroutine.done(); }
+
+        /**
+         * Join: start the task if needed, suspend until it completes and return its result (or rethrow).
+         */
+        auto operator co_await() const noexcept {
+          struct awaiter {
+            handle_type coroutine;
+
+            bool await_ready() const noexcept { return !coroutine || coroutine.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+              coroutine.promise().continuation = awaiting;
+              if(!coroutine.promise().started) {
+                coroutine.promise().started = true;
+                return coroutine;
+              }
+              return std::noop_coroutine();
+            }
+
+            T await_resume() { return coroutine.promise().result(); }
+          };
+          return awaiter{m_coroutine};
+        }
+
+    private:
+        handle_type m_coroutine;
+  };
+
+  namespace detail {
+    template<typename T>
+    task<T> task_promise<T>::get_return_object() noexcept {
+      return task<T>{std::coroutine_handle<task_promise<T>>::from_promise(*this)};
+    }
+
+    inline task<void> task_promise<void>::get_return_object() noexcept {
+      return task<void>{std::coroutine_handle<task_promise<void>>::from_promise(*this)};
+    }
+  } // !namespace detail
+
+  /**
+   * Fire and forget a task, e.g from on_start() or on_update().
+   */
+  template<typename T>
+  void spawn(task<T>&& t) {
+    t.detach();
+  }
+
+  /**
+   * Awaitable resuming the coroutine at a deadline, through the daemon's timer wheel.
+   */
+  class sleep_awaitable {
+    public:
+        sleep_awaitable(dscheduler& scheduler, const dscheduler::clock::time_point& deadline) noexcept :
+        m_scheduler(scheduler), m_deadline(deadline) {}
+        sleep_awaitable(const sleep_awaitable&) = delete;
+        sleep_awaitable& operator=(const sleep_awaitable&) = delete;
+
+        ~sleep_awaitable() {
+          // The suspended coroutine was destroyed, do not resume it.
+          if(!m_name.empty()) m_scheduler.cancel_task(m_name);
+        }
+
+        bool await_ready() const noexcept { return m_deadline <= dscheduler::clock::now(); }
+
+        void await_suspend(std::coroutine_handle<> coroutine) {
+          static std::uint64_t counter = 0;
+          m_name = "\x1f" "sleep#" + std::to_string(++counter);
+          m_scheduler.add_oneshot_task(m_name, m_deadline - dscheduler::clock::now(), [this, coroutine]() {
+            m_name.clear();
+            coroutine.resume();
+          });
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        dscheduler& m_scheduler;
+        dscheduler::clock::time_point m_deadline;
+        std::string m_name;
+  };
+
+  inline sleep_awaitable sleep_until(dscheduler& scheduler, const dscheduler::clock::time_point& deadline) {
+    return sleep_awaitable(scheduler, deadline);
+  }
+
+  template<typename Rep, typename Period>
+  sleep_awaitable sleep_for(dscheduler& scheduler, const std::chrono::duration<Rep, Period>& duration) {
+    return sleep_awaitable(scheduler, dscheduler::clock::now() + std::chrono::duration_cast<dscheduler::clock::duration>(duration));
+  }
+
+  /**
+   * Awaitable resuming the coroutine when a file descriptor is ready, through the daemon's event loop.
+   * co_await returns the ready epoll events mask (EPOLLERR if the fd can't be watched).
+   * @note: only one coroutine may wait on a given fd at a time.
+   */
+  class fd_awaitable {
+    public:
+        fd_awaitable(dloop& loop, int fd, std::uint32_t events) noexcept :
+        m_loop(loop), m_fd(fd), m_events(events) {}
+        fd_awaitable(const fd_awaitable&) = delete;
+        fd_awaitable& operator=(const fd_awaitable&) = delete;
+
+        ~fd_awaitable() {
+          if(m_pending) m_loop.remove_fd(m_fd);
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> coroutine) {
+          m_pending = m_loop.add_fd(m_fd, m_events, [this, coroutine](std::uint32_t events) {
+            m_result = events;
+            m_pending = false;
+            m_loop.remove_fd(m_fd);
+            coroutine.resume();
+          });
+          if(!m_pending) m_result = EPOLLERR;
+          return m_pending;
+        }
+
+        std::uint32_t await_resume() const noexcept { return m_result; }
+
+    private:
+        dloop& m_loop;
+        int m_fd;
+        std::uint32_t m_events;
+        std::uint32_t m_result{0};
+        bool m_pending{false};
+  };
+
+  inline fd_awaitable readable(dloop& loop, int fd) {
+    return fd_awaitable(loop, fd, EPOLLIN | EPOLLRDHUP);
+  }
+
+  inline fd_awaitable writable(dloop& loop, int fd) {
+    return fd_awaitable(loop, fd, EPOLLOUT);
+  }
+} // !namespace daemonpp
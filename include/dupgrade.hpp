@@ -0,0 +1,150 @@
+#pragma once
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "dlog.hpp"
+
+namespace daemonpp {
+  /**
+   * Hot upgrade handover between the running daemon and the new binary it execs, over a unix socketpair:
+   * the old process sends its listening fds (SCM_RIGHTS) and a serialized state blob, the new one answers
+   * with a single byte once its on_start() returned. The fd of the new process' end is passed in $DAEMONPP_UPGRADE_FD.
+   */
+  class dupgrade {
+    public:
+        static constexpr const char* ENV_FD = "DAEMONPP_UPGRADE_FD";
+        static constexpr char READY = 'R';
+
+        /**
+         * Send the fds (with their names) and the state blob.
+         * @return false on failure (logged)
+         */
+        static bool send(int sock, const std::vector<std::pair<std::string, int>>& fds, const std::string& state) {
+          if(fds.size() > MAX_FDS) {
+            dlog::error("Cannot hand over more than " + std::to_string(MAX_FDS) + " fds.");
+            return false;
+          }
+          std::string names;
+          for(const std::pair<std::string, int>& fd : fds) {
+            names += fd.first;
+            names += '\0';
+          }
+          header head{};
+          head.magic = MAGIC;
+          head.fd_count = static_cast<std::uint32_t>(fds.size());
+          head.names_size = static_cast<std::uint32_t>(names.size());
+          head.state_size = state.size();
+
+          // The fds ride along the header bytes, names and state follow on the stream.
+          iovec iov{&head, sizeof(head)};
+          std::vector<char> control(CMSG_SPACE(sizeof(int) * (fds.empty() ? 1 : fds.size())), 0);
+          msghdr msg{};
+          msg.msg_iov = &iov;
+          msg.msg_iovlen = 1;
+          if(!fds.empty()) {
+            msg.msg_control = control.data();
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+            int* data = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+            for(std::size_t i = 0; i < fds.size(); i++)
+              data[i] = fds[i].second;
+          }
+          ssize_t sent;
+          do { sent = ::sendmsg(sock, &msg, MSG_NOSIGNAL); } while(sent < 0 && errno == EINTR);
+          if(sent != static_cast<ssize_t>(sizeof(head))) {
+            dlog::error("Could not send upgrade handover: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          return write_all(sock, names.data(), names.size()) && write_all(sock, state.data(), state.size());
+        }
+
+        /**
+         * Receive the fds (made close-on-exec) and the state blob sent by send().
+         * @return false on failure (logged)
+         */
+        static bool receive(int sock, std::vector<std::pair<std::string, int>>& fds, std::string& state) {
+          header head{};
+          iovec iov{&head, sizeof(head)};
+          std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_FDS), 0);
+          msghdr msg{};
+          msg.msg_iov = &iov;
+          msg.msg_iovlen = 1;
+          msg.msg_control = control.data();
+          msg.msg_controllen = control.size();
+          ssize_t received;
+          do { received = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL); } while(received < 0 && errno == EINTR);
+          if(received != static_cast<ssize_t>(sizeof(head)) || head.magic != MAGIC) {
+            dlog::error("Could not receive upgrade handover: " + std::string(received < 0 ? std::strerror(errno) : "bad header"));
+            return false;
+          }
+          std::vector<int> received_fds;
+          for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            const std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            received_fds.insert(received_fds.end(), data, data + count);
+          }
+          std::string names(head.names_size, '\0');
+          state.assign(head.state_size, '\0');
+          if(!read_all(sock, &names[0], names.size()) || !read_all(sock, &state[0], state.size()) ||
+             received_fds.size() != head.fd_count || (msg.msg_flags & MSG_CTRUNC)) {
+            dlog::error("Upgrade handover is incomplete.");
+            for(int fd : received_fds) ::close(fd);
+            return false;
+          }
+          std::size_t begin = 0;
+          for(int fd : received_fds) {
+            const std::size_t end = names.find('\0', begin);
+            fds.emplace_back(names.substr(begin, end - begin), fd);
+            begin = end + 1;
+          }
+          return true;
+        }
+
+    private:
+        static constexpr std::uint32_t MAGIC = 0x44505547; // "DPUG"
+        static constexpr std::size_t MAX_FDS = 253;         // SCM_MAX_FD
+
+        struct header {
+          std::uint32_t magic;
+          std::uint32_t fd_count;
+          std::uint32_t names_size;
+          std::uint32_t reserved;
+          std::uint64_t state_size;
+        };
+
+        static bool write_all(int sock, const char* data, std::size_t size) {
+          while(size > 0) {
+            const ssize_t n = ::send(sock, data, size, MSG_NOSIGNAL);
+            if(n < 0) {
+              if(errno == EINTR) continue;
+              dlog::error("Could not send upgrade state: " + std::string(std::strerror(errno)));
+              return false;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+          }
+          return true;
+        }
+
+        static bool read_all(int sock, char* data, std::size_t size) {
+          while(size > 0) {
+            const ssize_t n = ::recv(sock, data, size, 0);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) return false;
+            data += n;
+            size -= static_cast<std::size_t>(n);
+          }
+          return true;
+        }
+  };
+} // !namespace daemonpp
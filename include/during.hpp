@@ -0,0 +1,185 @@
+#pragma once
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <algorithm>
+#include "dlog.hpp"
+
+// The ring needs the Linux 5.11 uapi headers (IORING_FEAT_EXT_ARG, io_uring_getevents_arg) at compile time. Without
+// them DAEMONPP_HAVE_IO_URING is 0 and dloop only has its epoll backend. Define it to 0 to leave io_uring out.
+#ifndef DAEMONPP_HAVE_IO_URING
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_ENTER_EXT_ARG) && defined(__NR_io_uring_setup)
+#define DAEMONPP_HAVE_IO_URING 1
+#else
+#define DAEMONPP_HAVE_IO_URING 0
+#endif
+#elif DAEMONPP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#if DAEMONPP_HAVE_IO_URING
+namespace daemonpp {
+  /**
+   * Minimal io_uring ring (no liburing dependency) used by dloop's io_uring backend.
+   * SQEs queued with get_sqe() are submitted in one batch by the next submit_and_wait().
+   * @note: requires Linux 5.11+ (IORING_FEAT_EXT_ARG), is_ok() is false otherwise.
+   */
+  class during {
+    public:
+        explicit during(unsigned entries) {
+          io_uring_params params{};
+          m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+          if(m_fd < 0) {
+            dlog::notice("io_uring is not available: " + std::string(std::strerror(errno)));
+            return;
+          }
+          if(!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            dlog::notice("io_uring is too old (Linux 5.11+ is required).");
+            return;
+          }
+          m_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(std::uint32_t),
+                                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+          m_ring = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+          if(m_ring == MAP_FAILED) {
+            m_ring = nullptr;
+            dlog::error("Could not map io_uring rings: " + std::string(std::strerror(errno)));
+            return;
+          }
+          m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+          void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+          if(sqes == MAP_FAILED) {
+            dlog::error("Could not map io_uring sqes: " + std::string(std::strerror(errno)));
+            return;
+          }
+          m_sqes = static_cast<io_uring_sqe*>(sqes);
+          char* ring = static_cast<char*>(m_ring);
+          m_sq_head = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+          m_sq_tail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+          m_sq_mask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+          m_sq_entries = params.sq_entries;
+          m_sq_array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+          m_cq_head = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+          m_cq_tail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+          m_cq_mask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+          m_cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+          m_ok = true;
+        }
+
+        during(const during&) = delete;
+        during& operator=(const during&) = delete;
+
+        ~during() {
+          if(m_sqes) munmap(m_sqes, m_sqes_size);
+          if(m_ring) munmap(m_ring, m_ring_size);
+          if(m_fd >= 0) ::close(m_fd);
+        }
+
+        bool is_ok() const noexcept { return m_ok; }
+
+        /**
+         * Next free submission entry, zeroed. Flushes queued entries to the kernel first if the ring is full.
+         */
+        io_uring_sqe* get_sqe() {
+          if(m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+            enter(0, 0, nullptr);
+          const unsigned index = m_sq_local_tail & m_sq_mask;
+          io_uring_sqe* sqe = &m_sqes[index];
+          std::memset(sqe, 0, sizeof(*sqe));
+          m_sq_array[index] = index;
+          m_sq_local_tail++;
+          return sqe;
+        }
+
+        /**
+         * Submit queued entries and wait for at least wait_nr completions, with a single syscall.
+         * @param timeout: maximum wait, nullptr waits forever
+         * @return false on error other than timeout/interruption
+         */
+        bool submit_and_wait(unsigned wait_nr, const __kernel_timespec* timeout) {
+          return enter(wait_nr, IORING_ENTER_GETEVENTS, timeout);
+        }
+
+        /**
+         * Pop up to `max` completions (user_data, res) into the given arrays.
+         * @return number of completions popped
+         */
+        unsigned pop_completions(std::uint64_t* user_data, std::int32_t* results, unsigned max) {
+          unsigned head = *m_cq_head;
+          const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+          unsigned count = 0;
+          while(head != tail && count < max) {
+            const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+            user_data[count] = cqe.user_data;
+            results[count] = cqe.res;
+            count++;
+            head++;
+          }
+          __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+          return count;
+        }
+
+        /**
+         * Register fixed buffers used by IORING_OP_READ_FIXED/WRITE_FIXED (pinned once, no per IO page mapping).
+         */
+        bool register_buffers(const iovec* buffers, unsigned count) {
+          if(syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers, count) < 0) {
+            dlog::error("Could not register io_uring buffers: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          return true;
+        }
+
+        bool unregister_buffers() {
+          return syscall(__NR_io_uring_register, m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) == 0;
+        }
+
+    private:
+        bool enter(unsigned wait_nr, unsigned flags, const __kernel_timespec* timeout) {
+          // Publish the queued entries
+          __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+          const unsigned to_submit = m_sq_local_tail - m_sq_submitted;
+          io_uring_getevents_arg arg{};
+          arg.sigmask_sz = _NSIG / 8;
+          arg.ts = reinterpret_cast<std::uint64_t>(timeout);
+          const long r = syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+          if(r < 0) {
+            if(errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) return true;
+            dlog::error("io_uring_enter failed: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          m_sq_submitted += static_cast<unsigned>(r);
+          return true;
+        }
+
+    private:
+        int m_fd{-1};
+        bool m_ok{false};
+        void* m_ring{nullptr};
+        std::size_t m_ring_size{0};
+        io_uring_sqe* m_sqes{nullptr};
+        std::size_t m_sqes_size{0};
+        unsigned* m_sq_head{nullptr};
+        unsigned* m_sq_tail{nullptr};
+        unsigned* m_sq_array{nullptr};
+        unsigned m_sq_mask{0};
+        unsigned m_sq_entries{0};
+        unsigned m_sq_local_tail{0};
+        unsigned m_sq_submitted{0};
+        unsigned* m_cq_head{nullptr};
+        unsigned* m_cq_tail{nullptr};
+        unsigned m_cq_mask{0};
+        io_uring_cqe* m_cqes{nullptr};
+  };
+} // !namespace daemonpp
+#endif // DAEMONPP_HAVE_IO_URING
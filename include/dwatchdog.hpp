@@ -0,0 +1,200 @@
+#pragma once
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <pthread.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "dlog.hpp"
+#include "dmetrics.hpp"
+#include "dnotify.hpp"
+
+namespace daemonpp {
+  /**
+   * Stuck tick detector: a thread watching the ticks of another thread (begin()/end() around each one).
+   * When a tick runs past its budget, it interrupts the ticking thread with a signal whose handler captures
+   * the thread's stack (backtrace()), logs the symbolized backtrace, counts daemonpp_stuck_ticks_total and
+   * optionally aborts the process so the service manager restarts it.
+   * @note: function names need the binary linked with -rdynamic (ENABLE_EXPORTS in CMake), addresses are logged anyway.
+   * @note: a syscall blocked in the stuck tick may fail with EINTR when not restartable (see signal(7)).
+   */
+  class dwatchdog {
+    public:
+        dwatchdog() = default;
+        dwatchdog(const dwatchdog&) = delete;
+        dwatchdog& operator=(const dwatchdog&) = delete;
+        ~dwatchdog() { stop(); }
+
+        /**
+         * Start watching the calling thread.
+         * @param budget: longest tick allowed
+         * @param abort_when_stuck: abort() after logging the backtrace of a stuck tick
+         * @return false on failure (logged)
+         */
+        bool start(const std::chrono::milliseconds& budget, bool abort_when_stuck) {
+          stop();
+          // backtrace() loads libgcc on its first call, which must not happen in the signal handler.
+          void* frame;
+          backtrace(&frame, 1);
+          struct sigaction action{};
+          action.sa_sigaction = &on_signal;
+          action.sa_flags = SA_SIGINFO | SA_RESTART;
+          sigemptyset(&action.sa_mask);
+          sigset_t mask;
+          sigemptyset(&mask);
+          sigaddset(&mask, signal_number());
+          if(sigaction(signal_number(), &action, nullptr) < 0 || pthread_sigmask(SIG_UNBLOCK, &mask, nullptr) != 0) {
+            dlog::error("Could not install the stuck tick signal handler: " + std::string(std::strerror(errno)));
+            return false;
+          }
+          m_watched = pthread_self();
+          m_budget = budget;
+          m_abort = abort_when_stuck;
+          m_stopping = false;
+          m_thread = std::thread([this]() { watch(); });
+          return true;
+        }
+
+        void stop() {
+          if(!m_thread.joinable()) return;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+          }
+          m_wakeup.notify_one();
+          m_thread.join();
+        }
+
+        bool is_running() const noexcept { return m_thread.joinable(); }
+
+        /**
+         * Run setup on the watchdog thread when it starts, e.g to drop the real time policy and CPU pin it inherits
+         * from the watched thread. Applies from the next start().
+         */
+        void set_thread_setup(std::function<void()> setup) { m_setup = std::move(setup); }
+
+        /**
+         * A tick started, on the watched thread.
+         */
+        void begin(const std::chrono::steady_clock::time_point& now) noexcept {
+          m_tick_begin.store(now.time_since_epoch().count(), std::memory_order_release);
+        }
+
+        /**
+         * The tick ended, on the watched thread.
+         */
+        void end() noexcept {
+          const std::int64_t begin = m_tick_begin.exchange(0, std::memory_order_acq_rel);
+          if(begin != 0 && m_reported.load(std::memory_order_acquire) == begin) {
+            const auto stuck = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(begin);
+            dlog::warning("Stuck tick completed after " + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(stuck).count()) + "ms.");
+          }
+        }
+
+        /**
+         * @return true while the running tick is past its budget, from any thread.
+         */
+        bool is_stuck() const noexcept {
+          const std::int64_t begin = m_tick_begin.load(std::memory_order_acquire);
+          return begin != 0 && begin == m_reported.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Signal used to interrupt the watched thread.
+         */
+        static int signal_number() { return SIGRTMIN + 1; }
+
+    private:
+        static constexpr int MAX_FRAMES = 64;
+
+        void watch() {
+          if(m_setup) m_setup();
+          const auto interval = std::max(m_budget / 4, std::chrono::milliseconds(10));
+          std::unique_lock<std::mutex> lock(m_mutex);
+          while(!m_wakeup.wait_for(lock, interval, [this]() { return m_stopping; })) {
+            const std::int64_t begin = m_tick_begin.load(std::memory_order_acquire);
+            if(begin == 0 || begin == m_reported.load(std::memory_order_relaxed)) continue;
+            const auto elapsed = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(begin);
+            if(elapsed > m_budget) {
+              m_reported.store(begin, std::memory_order_release);
+              report(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed));
+            }
+          }
+        }
+
+        void report(const std::chrono::milliseconds& elapsed) {
+          m_stuck_metric.inc();
+          const std::string what = "on_update() stuck for " + std::to_string(elapsed.count()) + "ms (budget " + std::to_string(m_budget.count()) + "ms)";
+          dnotify::status(what);
+          s_frame_count.store(-1, std::memory_order_relaxed);
+          if(pthread_kill(m_watched, signal_number()) != 0) {
+            dlog::critical(what + ", could not signal the loop thread.");
+          } else {
+            // The handler runs as soon as the thread is scheduled, even inside a blocking syscall.
+            for(int i = 0; i < 100 && s_frame_count.load(std::memory_order_acquire) < 0; i++)
+              std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            const int count = s_frame_count.load(std::memory_order_acquire);
+            dlog::critical(what + ", backtrace of the loop thread:");
+            char** symbols = count > 0 ? backtrace_symbols(s_frames, count) : nullptr;
+            // Frame 0 is the signal handler, frame 1 the kernel's signal trampoline.
+            for(int i = 2; i < count; i++)
+              dlog::critical("  #" + std::to_string(i - 2) + " " + (symbols ? demangle(symbols[i]) : std::string("?")));
+            if(count < 0) dlog::critical("  (the loop thread did not answer)");
+            std::free(symbols);
+          }
+          if(m_abort) {
+            dlog::critical("Aborting on stuck tick.");
+            dlog::flush();
+            std::abort();
+          }
+        }
+
+        /**
+         * "binary(_ZN3foo3barEv+0x1c) [0x55d0]" -> "binary(foo::bar()+0x1c) [0x55d0]"
+         */
+        static std::string demangle(const char* symbol) {
+          std::string line(symbol);
+          const std::size_t open = line.find('(');
+          const std::size_t plus = line.find('+', open);
+          if(open == std::string::npos || plus == std::string::npos || plus == open + 1) return line;
+          int status = 0;
+          char* name = abi::__cxa_demangle(line.substr(open + 1, plus - open - 1).c_str(), nullptr, nullptr, &status);
+          if(status == 0 && name) line = line.substr(0, open + 1) + name + line.substr(plus);
+          std::free(name);
+          return line;
+        }
+
+        static void on_signal(int, siginfo_t*, void*) {
+          const int saved_errno = errno;
+          s_frame_count.store(backtrace(s_frames, MAX_FRAMES), std::memory_order_release);
+          errno = saved_errno;
+        }
+
+    private:
+        std::thread m_thread;
+        std::function<void()> m_setup;
+        pthread_t m_watched{};
+        std::chrono::milliseconds m_budget{0};
+        bool m_abort{false};
+        std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        bool m_stopping{false};
+        std::atomic<std::int64_t> m_tick_begin{0}; // steady clock of the running tick's start, 0 between ticks
+        std::atomic<std::int64_t> m_reported{0};   // start of the last tick reported stuck
+        dmetrics::counter& m_stuck_metric{dmetrics::get_counter("daemonpp_stuck_ticks_total", "Ticks that ran past tick_budget_ms")};
+        static void* s_frames[MAX_FRAMES];
+        static std::atomic<int> s_frame_count;
+  };
+  void* dwatchdog::s_frames[dwatchdog::MAX_FRAMES]{};
+  std::atomic<int> dwatchdog::s_frame_count{0};
+} // !namespace daemonpp
@@ -0,0 +1,131 @@
+// dlog's async queue, through the binary sink: a blocking queue loses nothing, a dropping one accounts for every
+// message it drops, and stopping drains what was queued.
+#undef NDEBUG
+#include <unistd.h>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dlog.hpp"
+using namespace daemonpp;
+
+struct record {
+  std::uint32_t pid;
+  std::int32_t priority;
+  std::uint32_t format_id;
+  std::string data;
+};
+
+template<typename T>
+static T take(const std::string& log, std::size_t& at) {
+  assert(at + sizeof(T) <= log.size());
+  T value;
+  std::memcpy(&value, log.data() + at, sizeof(T));
+  at += sizeof(T);
+  return value;
+}
+
+/**
+ * The 'R' entries of a binary log (see dlog::start_binary()).
+ */
+static std::vector<record> read_records(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::vector<record> records;
+  std::size_t at = 0;
+  while(at < log.size()) {
+    const char type = log[at++];
+    if(type == 'H') {
+      assert(take<std::uint32_t>(log, at) == dlog::BINARY_VERSION);
+      assert(take<std::uint32_t>(log, at) == static_cast<std::uint32_t>(getpid()));
+      take<std::int64_t>(log, at);
+    } else if(type == 'F') {
+      take<std::uint32_t>(log, at);
+      take<std::uint32_t>(log, at);
+      at += take<std::uint32_t>(log, at);
+    } else {
+      assert(type == 'R');
+      record r;
+      r.pid = take<std::uint32_t>(log, at);
+      take<std::int64_t>(log, at);
+      r.priority = take<std::int32_t>(log, at);
+      r.format_id = take<std::uint32_t>(log, at);
+      const std::uint32_t size = take<std::uint32_t>(log, at);
+      assert(at + size <= log.size());
+      r.data.assign(log, at, size);
+      at += size;
+      records.push_back(r);
+    }
+  }
+  assert(at == log.size());
+  return records;
+}
+
+/**
+ * Log `count` messages from each of `threads` threads.
+ */
+static void produce(int threads, int count) {
+  std::vector<std::thread> producers;
+  for(int t = 0; t < threads; t++)
+    producers.emplace_back([count]() {
+      for(int i = 0; i < count; i++) dlog::info("message " + std::to_string(i));
+    });
+  for(std::thread& producer : producers) producer.join();
+}
+
+int main() {
+  char directory[] = "/tmp/dlog-async-test.XXXXXX";
+  assert(mkdtemp(directory));
+  const std::string blocking = std::string(directory) + "/blocking.dlog";
+  const std::string dropping = std::string(directory) + "/dropping.dlog";
+  const int threads = 4;
+  const int count = 20000;
+
+  // Blocking overflow: producers wait for room, every message is written once stopped.
+  assert(dlog::start_binary(blocking, 16, dlog::overflow::block));
+  assert(dlog::is_async());
+  produce(threads, count);
+  dlog::stop_async();
+  assert(!dlog::is_async());
+  std::vector<record> records = read_records(blocking);
+  assert(records.size() == static_cast<std::size_t>(threads * count));
+  assert(dlog::get_dropped() == 0);
+  for(const record& r : records)
+    assert(r.pid == static_cast<std::uint32_t>(getpid()) && r.priority == LOG_INFO && r.format_id == 0 &&
+           r.data.compare(0, 8, "message ") == 0);
+
+  // Dropping overflow: written and dropped messages add up, the writer reports each drop as a warning.
+  assert(dlog::start_binary(dropping, 16, dlog::overflow::drop));
+  produce(threads, count);
+  dlog::stop_async();
+  std::uint64_t written = 0, reported = 0;
+  for(const record& r : read_records(dropping)) {
+    if(r.priority == LOG_WARNING) {
+      assert(r.data.find("log messages dropped") != std::string::npos);
+      reported += std::strtoull(r.data.c_str(), nullptr, 10);
+    } else {
+      written++;
+    }
+  }
+  assert(reported == dlog::get_dropped());
+  assert(written + reported == static_cast<std::uint64_t>(threads * count));
+
+  // A queue with the same capacity is reused by the next start, and drained again on stop.
+  assert(dlog::start_binary(blocking, 16, dlog::overflow::block));
+  dlog::info("after restart");
+  dlog::shutdown();
+  records = read_records(blocking);
+  assert(records.size() == static_cast<std::size_t>(threads * count + 1) && records.back().data == "after restart");
+
+  ::unlink(blocking.c_str());
+  ::unlink(dropping.c_str());
+  ::rmdir(directory);
+  std::puts("dlog_async_test: OK");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+// dlog's journal sink against a datagram socket standing in for journald: the fields of each record, the binary
+// form of multiline values and the sealed memfd fallback of records too large for a datagram.
+#undef NDEBUG
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// The memfd fallback is out of reach of public calls: records are capped far below the datagram limit.
+#define private public
+#include "dlog.hpp"
+#undef private
+using namespace daemonpp;
+
+using fields = std::map<std::string, std::string>;
+
+/**
+ * Decode a journal native protocol entry: "NAME=value\n", or "NAME\n" <u64 le size> value "\n" for binary values.
+ */
+static fields decode(const std::string& entry) {
+  fields decoded;
+  std::size_t at = 0;
+  while(at < entry.size()) {
+    const std::size_t end = entry.find_first_of("=\n", at);
+    assert(end != std::string::npos);
+    const std::string name = entry.substr(at, end - at);
+    if(entry[end] == '=') {
+      const std::size_t newline = entry.find('\n', end);
+      assert(newline != std::string::npos);
+      decoded[name] = entry.substr(end + 1, newline - end - 1);
+      at = newline + 1;
+      continue;
+    }
+    assert(end + 9 <= entry.size());
+    std::uint64_t size = 0;
+    for(int i = 0; i < 8; i++)
+      size |= static_cast<std::uint64_t>(static_cast<unsigned char>(entry[end + 1 + i])) << (8 * i);
+    assert(end + 9 + size + 1 <= entry.size() && entry[end + 9 + size] == '\n');
+    decoded[name] = entry.substr(end + 9, size);
+    at = end + 9 + size + 1;
+  }
+  return decoded;
+}
+
+/**
+ * Next datagram on the listener, or the content of the memfd it carries.
+ */
+static std::string receive(int listener) {
+  std::vector<char> buffer(64 * 1024);
+  union {
+    cmsghdr header;
+    char data[CMSG_SPACE(sizeof(int))];
+  } control{};
+  iovec part{buffer.data(), buffer.size()};
+  msghdr message{};
+  message.msg_iov = &part;
+  message.msg_iovlen = 1;
+  message.msg_control = &control;
+  message.msg_controllen = sizeof(control);
+  const ssize_t n = recvmsg(listener, &message, MSG_CMSG_CLOEXEC);
+  assert(n >= 0);
+  const cmsghdr* rights = CMSG_FIRSTHDR(&message);
+  if(!rights) return std::string(buffer.data(), static_cast<std::size_t>(n));
+  assert(n == 0 && rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS);
+  int fd;
+  std::memcpy(&fd, CMSG_DATA(rights), sizeof(fd));
+  // journald only accepts sealed memfds
+  const int seals = fcntl(fd, F_GET_SEALS);
+  assert(seals >= 0 && (seals & F_SEAL_WRITE) && (seals & F_SEAL_SHRINK) && (seals & F_SEAL_GROW));
+  std::string content;
+  char chunk[65536];
+  ssize_t got;
+  while((got = pread(fd, chunk, sizeof(chunk), static_cast<off_t>(content.size()))) > 0)
+    content.append(chunk, static_cast<std::size_t>(got));
+  ::close(fd);
+  return content;
+}
+
+int main() {
+  char directory[] = "/tmp/dlog-journal-test.XXXXXX";
+  assert(mkdtemp(directory));
+  const std::string path = std::string(directory) + "/socket";
+  const int listener = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  assert(listener >= 0);
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  assert(bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+  const timeval timeout{5, 0};
+  setsockopt(listener, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  dlog::init("dlog-journal-test");
+  assert(!dlog::start_journal(std::string(directory) + "/missing"));
+  assert(dlog::start_journal(path));
+
+  assert(!dlog::set_field("_TRUSTED", "1"));
+  assert(!dlog::set_field("lower", "1"));
+  assert(!dlog::set_field("VALUE", "two\nlines"));
+  assert(dlog::set_field("REQUEST_ID", "41"));
+  assert(dlog::set_field("REQUEST_ID", "42"));
+  const std::uint32_t line = __LINE__ + 1;
+  dlog::warning("deferred {} and {}", 42, std::string("str"));
+  dlog::clear_field("REQUEST_ID");
+  dlog::info(std::string("first line\nsecond line"));
+  dlog::flush();
+
+  fields entry = decode(receive(listener));
+  assert(entry["MESSAGE"] == "deferred 42 and str");
+  assert(entry["PRIORITY"] == std::to_string(LOG_WARNING));
+  assert(entry["SYSLOG_IDENTIFIER"] == "dlog-journal-test");
+  assert(entry["SYSLOG_FACILITY"] == std::to_string(LOG_DAEMON >> 3));
+  assert(entry["CODE_FILE"].find("dlog_journal_test.cpp") != std::string::npos);
+  assert(entry["CODE_LINE"] == std::to_string(line));
+  assert(entry["REQUEST_ID"] == "42");
+
+  entry = decode(receive(listener));
+  assert(entry["MESSAGE"] == "first line\nsecond line");
+  assert(entry["PRIORITY"] == std::to_string(LOG_INFO));
+  assert(entry.count("REQUEST_ID") == 0);
+
+  // A burst larger than a sendmmsg() batch arrives whole and in order.
+  const int burst = 200;
+  for(int i = 0; i < burst; i++) dlog::info("burst {}", i);
+  dlog::flush();
+  for(int i = 0; i < burst; i++)
+    assert(decode(receive(listener))["MESSAGE"] == "burst " + std::to_string(i));
+
+  std::string big(300000, 'x');
+  assert(dlog::send_memfd(dlog::get_writer(), "MESSAGE=" + big + "\n"));
+  entry = decode(receive(listener));
+  assert(entry["MESSAGE"] == big);
+
+  dlog::shutdown();
+  ::close(listener);
+  ::unlink(path.c_str());
+  ::rmdir(directory);
+  std::puts("dlog_journal_test: OK");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,46 @@
+// dscheduler's periodic tasks after the loop stalls: the missed runs are skipped, one call per wake up, and the
+// following calls stay in phase.
+#undef NDEBUG
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include "dscheduler.hpp"
+using namespace daemonpp;
+
+int main() {
+  dloop loop;
+  dscheduler scheduler(loop);
+  const dscheduler::clock::time_point start = dscheduler::clock::now();
+  int calls = 0;
+  bool stalled = false, done = false;
+  scheduler.add_task("periodic", std::chrono::milliseconds(10), [&calls]() { calls++; });
+  scheduler.add_oneshot_task("stall", std::chrono::milliseconds(25), [&stalled]() {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    stalled = true;
+  });
+  scheduler.add_oneshot_task("done", std::chrono::milliseconds(1100), [&done]() { done = true; });
+
+  int calls_after_stall = -1;
+  while(!done) {
+    const int before = calls;
+    loop.run_once(-1);
+    assert(calls - before <= 1);
+    if(stalled && calls_after_stall < 0) calls_after_stall = calls;
+  }
+  // ~2 calls before the stall, 100 missed and skipped, ~10 in the last 100 ms.
+  assert(calls_after_stall >= 2 && calls_after_stall <= 4);
+  assert(calls <= calls_after_stall + 12);
+
+  // Still in phase: the next call is due on a multiple of the period since the task was added.
+  const dscheduler::task_info task = scheduler.get_tasks().front();
+  assert(task.name == "periodic");
+  const auto next = dscheduler::clock::now() + task.due_in - start;
+  const auto offset = std::chrono::duration_cast<std::chrono::milliseconds>(next).count() % 10;
+  assert(offset <= 1 || offset >= 9);
+
+  std::puts("dscheduler_test: OK");
+  return EXIT_SUCCESS;
+}
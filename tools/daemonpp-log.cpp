@@ -0,0 +1,125 @@
+// Decode the binary logs written by dlog::start_binary() (log_binary_file in the daemon's .conf file).
+//
+//   daemonpp-log /var/log/my_daemon/my_daemon.dlog
+//   daemonpp-log -p warning my_daemon.dlog      # warnings and worse only
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include "dlog.hpp"
+using namespace daemonpp;
+
+static void usage(const char* program) {
+  std::fprintf(stderr, "usage: %s [-p priority] [file...]\n"
+                       "  -p: lowest priority shown (emergency..debug, or 0..7), all by default\n"
+                       "  reads stdin without file\n", program);
+}
+
+template<typename T>
+static bool take(std::istream& in, T& value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+static std::string timestamp(std::int64_t ns) {
+  const std::time_t seconds = static_cast<std::time_t>(ns / 1000000000);
+  std::tm local{};
+  localtime_r(&seconds, &local);
+  char text[64];
+  const std::size_t n = std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+  std::snprintf(text + n, sizeof(text) - n, ".%06lld", static_cast<long long>(ns % 1000000000 / 1000));
+  return text;
+}
+
+/**
+ * Print the records of one log.
+ * @return false on a malformed or truncated log
+ */
+static bool decode(std::istream& in, const std::string& name, int max_priority) {
+  // Format ids of each writing process: during a hot upgrade two of them append to the log.
+  std::unordered_map<std::uint32_t, std::unordered_map<std::uint32_t, std::string>> formats;
+  std::uint32_t version = dlog::BINARY_VERSION;
+  std::uint32_t header_pid = 0;
+  std::string data, message;
+  char type;
+  while(in.get(type)) {
+    switch(type) {
+      case 'H': {
+        std::int64_t started;
+        if(!take(in, version) || !take(in, header_pid) || !take(in, started)) break;
+        if(version != 1 && version != dlog::BINARY_VERSION) {
+          std::fprintf(stderr, "%s: unsupported version %u\n", name.c_str(), version);
+          return false;
+        }
+        formats[header_pid].clear();
+        continue;
+      }
+      case 'F': {
+        std::uint32_t pid = header_pid, id, size;
+        if((version > 1 && !take(in, pid)) || !take(in, id) || !take(in, size)) break;
+        std::string& format = formats[pid][id];
+        format.resize(size);
+        if(size > 0 && !in.read(&format[0], size)) break;
+        continue;
+      }
+      case 'R': {
+        std::uint32_t pid = header_pid;
+        std::int64_t time_ns;
+        std::int32_t priority;
+        std::uint32_t id, size;
+        if((version > 1 && !take(in, pid)) || !take(in, time_ns) || !take(in, priority) || !take(in, id) || !take(in, size)) break;
+        data.resize(size);
+        if(size > 0 && !in.read(&data[0], size)) break;
+        if(priority > max_priority) continue;
+        message.clear();
+        if(id == 0) {
+          message = data;
+        } else {
+          const std::unordered_map<std::uint32_t, std::string>& pid_formats = formats[pid];
+          auto format = pid_formats.find(id);
+          if(format == pid_formats.end()) message = "<unknown format " + std::to_string(id) + ">";
+          else dlog::format_args(format->second.c_str(), data.data(), data.size(), message);
+        }
+        std::cout << timestamp(time_ns) << " [" << pid << "] " << dlog::priority_str(priority) << ": " << message << '\n';
+        continue;
+      }
+      default:
+        std::fprintf(stderr, "%s: not a dlog binary log, or corrupted\n", name.c_str());
+        return false;
+    }
+    std::fprintf(stderr, "%s: truncated entry\n", name.c_str());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  int max_priority = LOG_DEBUG;
+  int opt;
+  while((opt = getopt(argc, argv, "p:h")) != -1) {
+    switch(opt) {
+      case 'p':
+        if((max_priority = dlog::priority_of(optarg)) < 0) {
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  bool ok = true;
+  if(optind == argc) return decode(std::cin, "stdin", max_priority) ? EXIT_SUCCESS : EXIT_FAILURE;
+  for(int i = optind; i < argc; i++) {
+    std::ifstream in(argv[i], std::ios::binary);
+    if(!in) {
+      std::perror(argv[i]);
+      ok = false;
+      continue;
+    }
+    ok = decode(in, argv[i], max_priority) && ok;
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
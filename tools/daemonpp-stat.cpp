@@ -0,0 +1,94 @@
+// Read a daemon's stats segment (/dev/shm/<name>.stats) without talking to the daemon.
+//
+//   daemonpp-stat my_daemon              # status, tick counters and metrics, once
+//   daemonpp-stat -w 10 my_daemon        # one line per new tick, polled every 10ms (100Hz)
+//   daemonpp-stat -w 1000 -c 60 my_daemon.0
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "dstats.hpp"
+using namespace daemonpp;
+
+static double ms(std::uint64_t ns) { return static_cast<double>(ns) / 1e6; }
+
+static double age_s(std::int64_t updated_ns) {
+  const std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  return static_cast<double>(now - updated_ns) / 1e9;
+}
+
+static void print_all(const dstats::snapshot& snap) {
+  std::printf("pid %u  status '%s'  updated %.3fs ago\n", snap.pid, snap.status.c_str(), age_s(snap.updated_ns));
+  const dstats::tick_info& t = snap.tick;
+  std::printf("ticks %llu  overruns %llu  missed %llu  period %.3fms x%u%s\n",
+              static_cast<unsigned long long>(t.ticks), static_cast<unsigned long long>(t.overruns),
+              static_cast<unsigned long long>(t.missed), ms(t.period_ns), t.stretch, t.flags & dstats::SHEDDING ? "  shedding" : "");
+  std::printf("lateness last %.3fms max %.3fms  on_update() last %.3fms\n\n", ms(t.last_lateness_ns), ms(t.max_lateness_ns), ms(t.last_update_ns));
+  std::printf("%-60s %14s %10s %12s %12s %12s %12s\n", "metric", "value/sum", "count", "p50", "p90", "p99", "max");
+  for(const dstats::entry& e : snap.entries) {
+    if(e.kind == static_cast<std::uint32_t>(dmetrics::type::histogram))
+      std::printf("%-60s %14.6g %10llu %12.6g %12.6g %12.6g %12.6g\n", e.name, e.value, static_cast<unsigned long long>(e.count), e.p50, e.p90, e.p99, e.max);
+    else
+      std::printf("%-60s %14.6g\n", e.name, e.value);
+  }
+  if(snap.dropped > 0) std::printf("(%u metrics not published, over %zu)\n", snap.dropped, dstats::MAX_ENTRIES);
+  std::printf("(metrics published %.3fs ago, histogram quantiles over the last stats_interval_ms)\n", age_s(snap.metrics_updated_ns));
+}
+
+static void usage(const char* program) {
+  std::fprintf(stderr, "usage: %s [-w interval_ms] [-c count] <daemon name | segment path>\n"
+                       "  -w: watch the tick counters, polling every interval_ms\n"
+                       "  -c: stop watching after count lines\n", program);
+}
+
+int main(int argc, char* argv[]) {
+  long interval_ms = 0, count = -1;
+  int opt;
+  while((opt = getopt(argc, argv, "w:c:h")) != -1) {
+    switch(opt) {
+      case 'w': interval_ms = std::atol(optarg); break;
+      case 'c': count = std::atol(optarg); break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  const std::string target = argv[optind];
+  const std::string path = target.find('/') == std::string::npos ? dstats::path_of(target) : target;
+  dstats::reader reader;
+  if(!reader.open(path)) {
+    std::fprintf(stderr, "%s: %s\n", path.c_str(), errno == EPROTO ? "not a daemonpp stats segment" : std::strerror(errno));
+    return EXIT_FAILURE;
+  }
+  dstats::snapshot snap;
+  if(interval_ms <= 0) {
+    if(!reader.read(snap)) {
+      std::fprintf(stderr, "%s: no consistent read\n", path.c_str());
+      return EXIT_FAILURE;
+    }
+    print_all(snap);
+    return EXIT_SUCCESS;
+  }
+
+  std::printf("%12s %12s %14s %14s %10s %8s\n", "ticks", "overruns", "lateness_ms", "on_update_ms", "period_ms", "stretch");
+  std::uint64_t last_ticks = 0;
+  for(long lines = 0; count < 0 || lines < count;) {
+    if(reader.read(snap) && snap.tick.ticks != last_ticks) {
+      const dstats::tick_info& t = snap.tick;
+      std::printf("%12llu %12llu %14.3f %14.3f %10.1f %7ux%s\n", static_cast<unsigned long long>(t.ticks),
+                  static_cast<unsigned long long>(t.overruns), ms(t.last_lateness_ns), ms(t.last_update_ns), ms(t.period_ns),
+                  t.stretch, t.flags & dstats::SHEDDING ? " shedding" : "");
+      std::fflush(stdout);
+      last_ticks = t.ticks;
+      lines++;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,42 @@
+// Send a command to a daemon's control socket (/run/<name>/control.sock) and print its answer.
+//
+//   daemonppctl my_daemon help
+//   daemonppctl my_daemon period 500
+//   daemonppctl -s /run/my_daemon/control.0.sock my_daemon pause my_task
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "dcontrol.hpp"
+using namespace daemonpp;
+
+static void usage(const char* program) {
+  std::fprintf(stderr, "usage: %s [-s socket] <daemon name> <command> [args...]\n"
+                       "  -s: control socket path, /run/<daemon name>/control.sock by default\n"
+                       "  try the 'help' command for the daemon's commands\n", program);
+}
+
+int main(int argc, char* argv[]) {
+  std::string path;
+  int opt;
+  while((opt = getopt(argc, argv, "+s:h")) != -1) {
+    switch(opt) {
+      case 's': path = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if(argc - optind < 2) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if(path.empty()) path = "/run/" + std::string(argv[optind]) + "/control.sock";
+  std::string line = argv[optind + 1];
+  for(int i = optind + 2; i < argc; i++)
+    line += std::string(" ") + argv[i];
+
+  std::string output;
+  const bool ok = dcontrol::call(path, line, output);
+  std::fputs(output.c_str(), ok ? stdout : stderr);
+  if(!output.empty() && output.back() != '\n') std::fputc('\n', ok ? stdout : stderr);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}